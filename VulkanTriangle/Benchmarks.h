@@ -0,0 +1,400 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "MemoryAllocator.h"
+#include "StagingPool.h"
+#include "FrameRingAllocator.h"
+#include "JobSystem.h"
+#include "ParallelCommandRecorder.h"
+#include "PipelineRegistry.h"
+#include "ShaderReflection.h"
+#include "SceneConstants.h"
+
+// measurements the application runs at startup or over its first frames, each behind an enable...Benchmark toggle in
+// main.cpp, they print their results and leave the renderer as it was
+//   startup benchmarks - free functions taking a BenchmarkRenderer, filled in once everything they touch exists
+//   frame benchmarks   - a FrameBenchmark steps through variants of the scene's pipeline while the render loop draws
+
+// what the startup benchmarks use of the renderer
+// the helpers are the application's own, so the benchmarks measure the paths it takes
+struct BenchmarkRenderer {
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t graphicsFamily = 0;
+	DeviceMemoryAllocator* allocator = nullptr;
+	StagingPool* stagingPool = nullptr;
+	std::function<void(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer,
+		MemoryAllocation& memory)> createBuffer;
+	std::function<void(VkBuffer src, VkBuffer dst, VkDeviceSize size)> copyBuffer; // recorded into the open upload batch
+	std::function<void(const std::vector<StagingSpan>& spans, VkBuffer dst, VkDeviceSize dstOffset)> copyStaged; // the same
+	std::function<void()> flushUploads; // submits the upload batch and waits for it
+
+	// drawing the scene into secondary command buffers
+	std::function<VkCommandBufferInheritanceInfo(VkCommandBufferInheritanceRenderingInfo& rendering)> drawInheritance;
+	std::function<void(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount)> recordDraws; // a draw list range
+	std::function<void(VkCommandBuffer commandBuffer)> bindDrawState; // everything a draw needs but descriptors and constants
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	uint32_t indexCount = 0; // of the model every draw draws
+	float aspectRatio = 1.0f; // of the swap chain
+
+	// the uniform buffer of every object (shader.vert), objectConstantsStride apart
+	const ShaderReflection* shaderInterface = nullptr;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDeviceSize objectConstantsStride = sizeof(UniformBufferObject);
+	std::vector<VkDescriptorImageInfo> textureImages; // what every element of texSampler is bound to
+	bool dynamicUniformBuffer = false; // the layout's uniform buffer takes a dynamic offset
+};
+
+// throughput of many small uploads: a staging buffer per asset (the old path) vs the staging pool
+inline void benchmarkUploads(const BenchmarkRenderer& renderer)
+{
+	const uint32_t assetCount = 512;
+	const VkDeviceSize assetSize = 64 * 1024;
+	std::vector<char> asset(static_cast<size_t>(assetSize), 1);
+
+	VkBuffer destination;
+	MemoryAllocation destinationMemory;
+	renderer.createBuffer(assetSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		destination, destinationMemory);
+
+	// create, fill, copy and destroy a staging buffer for every asset
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < assetCount; i++)
+	{
+		VkBuffer stagingBuffer;
+		MemoryAllocation stagingBufferMemory;
+		renderer.createBuffer(assetSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer, stagingBufferMemory);
+		memcpy(stagingBufferMemory.mappedData, asset.data(), static_cast<size_t>(assetSize));
+		renderer.copyBuffer(stagingBuffer, destination, assetSize);
+		// the staging buffer is destroyed right away, so the copy has to be finished by then
+		renderer.flushUploads();
+		vkDestroyBuffer(renderer.device, stagingBuffer, nullptr);
+		renderer.allocator->free(stagingBufferMemory);
+	}
+	double bufferPerAssetSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// the same assets through the staging pool
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < assetCount; i++)
+	{
+		renderer.copyStaged(renderer.stagingPool->stage(asset.data(), assetSize), destination, 0);
+		renderer.flushUploads();
+	}
+	double stagingPoolSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	double megabytes = double(assetCount) * assetSize / (1024.0 * 1024.0);
+	std::cout << "upload benchmark (" << assetCount << " assets of " << assetSize / 1024 << " KiB): "
+		<< "staging buffer per asset " << megabytes / bufferPerAssetSeconds << " MB/s, "
+		<< "staging pool " << megabytes / stagingPoolSeconds << " MB/s\n";
+
+	vkDestroyBuffer(renderer.device, destination, nullptr);
+	renderer.allocator->free(destinationMemory);
+}
+// record time of large draw lists with 1 to maxThreads threads (nothing is submitted)
+inline void benchmarkRecording(const BenchmarkRenderer& renderer, uint32_t maxThreads)
+{
+	const uint32_t drawCounts[] = { 10000, 100000 };
+	const uint32_t iterations = 5;
+	for (uint32_t drawCount : drawCounts) {
+		std::cout << "recording benchmark (" << drawCount << " draws):";
+		double singleThreadMilliseconds = 0.0;
+		for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+			JobSystem jobs;
+			jobs.init(threads);
+			ParallelCommandRecorder recorder;
+			recorder.init(renderer.device, renderer.graphicsFamily, 1, jobs, threads);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < iterations; i++) {
+				VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+				recorder.record(0, renderer.drawInheritance(renderingInheritance), drawCount, renderer.recordDraws);
+			}
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+			recorder.destroy();
+			jobs.destroy();
+
+			if (threads == 1) singleThreadMilliseconds = milliseconds;
+			std::cout << " " << threads << (threads == 1 ? " thread " : " threads ") << milliseconds << " ms (x"
+				<< singleThreadMilliseconds / milliseconds << ")";
+		}
+		std::cout << "\n";
+	}
+}
+// CPU time of a frame of many objects with transforms of their own (writing them and recording the draws, on one thread,
+// nothing is submitted): uniform buffers in one buffer bound with dynamic offsets, the same buffers bound with a descriptor
+// set per object, and MVP matrices multiplied on the CPU and pushed
+inline void benchmarkObjectConstants(const BenchmarkRenderer& renderer)
+{
+	if (!renderer.dynamicUniformBuffer) {
+		// the sets come from the renderer's descriptor set layout, which has no dynamic offsets then
+		std::cout << "object constants benchmark: skipped, it needs enableDynamicUniformBuffer\n";
+		return;
+	}
+	const uint32_t objectCounts[] = { 1000, 10000 };
+	const uint32_t maxObjects = 10000;
+	const uint32_t iterations = 5;
+	const char* schemeNames[] = { "dynamic offsets", "descriptor set per object", "push constants" };
+
+	glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), renderer.aspectRatio, 0.1f, 10.0f);
+	proj[1][1] *= -1;
+
+	// laid out like the frame's constants, a slot per object
+	VkBuffer constantsBuffer;
+	MemoryAllocation constantsMemory;
+	renderer.createBuffer(renderer.objectConstantsStride * maxObjects, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, constantsBuffer, constantsMemory);
+	char* constants = static_cast<char*>(constantsMemory.mappedData);
+	std::vector<ObjectTransform> pushedTransforms(maxObjects);
+
+	// a set per object pointing at its slot, bound with dynamic offset 0
+	VkDescriptorPool objectPool;
+	std::vector<VkDescriptorPoolSize> poolSizes = renderer.shaderInterface->poolSizes(maxObjects);
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxObjects;
+	if (vkCreateDescriptorPool(renderer.device, &poolInfo, nullptr, &objectPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+	std::vector<VkDescriptorSetLayout> layouts(maxObjects, renderer.descriptorSetLayout);
+	std::vector<VkDescriptorSet> objectSets(maxObjects);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = objectPool;
+	allocInfo.descriptorSetCount = maxObjects;
+	allocInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(renderer.device, &allocInfo, objectSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate descriptor sets!");
+	}
+	const ReflectedBinding* uboBinding = renderer.shaderInterface->find("ubo");
+	const ReflectedBinding* samplerBinding = renderer.shaderInterface->find("texSampler");
+	std::vector<VkDescriptorBufferInfo> bufferInfos(maxObjects);
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	for (uint32_t object = 0; object < maxObjects; object++) {
+		bufferInfos[object].buffer = constantsBuffer;
+		bufferInfos[object].offset = object * renderer.objectConstantsStride;
+		bufferInfos[object].range = sizeof(UniformBufferObject);
+
+		VkWriteDescriptorSet bufferWrite{};
+		bufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		bufferWrite.dstSet = objectSets[object];
+		bufferWrite.dstBinding = uboBinding->binding;
+		bufferWrite.descriptorType = uboBinding->type;
+		bufferWrite.descriptorCount = 1;
+		bufferWrite.pBufferInfo = &bufferInfos[object];
+		descriptorWrites.push_back(bufferWrite);
+
+		VkWriteDescriptorSet imageWrite{};
+		imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		imageWrite.dstSet = objectSets[object];
+		imageWrite.dstBinding = samplerBinding->binding;
+		imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		imageWrite.descriptorCount = static_cast<uint32_t>(renderer.textureImages.size());
+		imageWrite.pImageInfo = renderer.textureImages.data();
+		descriptorWrites.push_back(imageWrite);
+	}
+	vkUpdateDescriptorSets(renderer.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	// the dynamic offset scheme moves the offset of a single set over every slot
+	VkDescriptorSet sharedSet = objectSets[0];
+
+	JobSystem jobs;
+	jobs.init(1);
+	ParallelCommandRecorder recorder;
+	recorder.init(renderer.device, renderer.graphicsFamily, 1, jobs, 1);
+
+	for (uint32_t objectCount : objectCounts) {
+		std::cout << "object constants benchmark (" << objectCount << " objects):";
+		for (uint32_t scheme = 0; scheme < 3; scheme++) {
+			bool pushConstants = scheme == 2;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < iterations; i++) {
+				for (uint32_t object = 0; object < objectCount; object++) {
+					glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.001f * object, 0.0f, 0.0f));
+					if (pushConstants) {
+						pushedTransforms[object].mvp = proj * view * model;
+					}
+					else {
+						UniformBufferObject ubo{};
+						ubo.model = model;
+						ubo.view = view;
+						ubo.proj = proj;
+						copyToMapped(constants + object * renderer.objectConstantsStride, &ubo, sizeof(ubo));
+					}
+				}
+				VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+				recorder.record(0, renderer.drawInheritance(renderingInheritance), objectCount,
+					[&](VkCommandBuffer secondary, uint32_t firstDraw, uint32_t count) {
+						renderer.bindDrawState(secondary);
+						uint32_t noOffset = 0;
+						if (pushConstants) {
+							vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer.pipelineLayout, 0, 1, &sharedSet, 1, &noOffset);
+						}
+						for (uint32_t draw = firstDraw; draw < firstDraw + count; draw++) {
+							if (scheme == 0) {
+								uint32_t dynamicOffset = static_cast<uint32_t>(draw * renderer.objectConstantsStride);
+								vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer.pipelineLayout, 0, 1, &sharedSet, 1, &dynamicOffset);
+							}
+							else if (scheme == 1) {
+								vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer.pipelineLayout, 0, 1, &objectSets[draw], 1, &noOffset);
+							}
+							else {
+								vkCmdPushConstants(secondary, renderer.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ObjectTransform), &pushedTransforms[draw]);
+							}
+							vkCmdDrawIndexed(secondary, renderer.indexCount, 1, 0, 0, 0);
+						}
+					});
+			}
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+			std::cout << " " << schemeNames[scheme] << " " << milliseconds << " ms";
+		}
+		std::cout << "\n";
+	}
+
+	recorder.destroy();
+	jobs.destroy();
+	vkDestroyDescriptorPool(renderer.device, objectPool, nullptr);
+	vkDestroyBuffer(renderer.device, constantsBuffer, nullptr);
+	renderer.allocator->free(constantsMemory);
+}
+// spawn overhead of empty jobs and scaling of a CPU only workload with 1 to every hardware thread
+inline void benchmarkJobSystem()
+{
+	const uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	{
+		const uint32_t jobCount = 100000;
+		JobSystem jobs;
+		jobs.init(hardwareThreads);
+		auto start = std::chrono::high_resolution_clock::now();
+		JobCounter counter;
+		for (uint32_t i = 0; i < jobCount; i++) {
+			jobs.run([]() {}, &counter);
+		}
+		jobs.wait(counter);
+		double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "job system benchmark: " << nanoseconds / jobCount << " ns per empty job (" << hardwareThreads << " threads)\n";
+		jobs.destroy();
+	}
+
+	// sums a few million square roots in chunks, nothing is shared between the chunks but the result slots
+	const uint32_t elementCount = 1 << 24;
+	const uint32_t grainSize = 1 << 14;
+	std::cout << "job system scaling (" << elementCount << " elements):";
+	double singleThreadMilliseconds = 0.0;
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threads = 1; threads < hardwareThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardwareThreads);
+	for (uint32_t threads : threadCounts) {
+		JobSystem jobs;
+		jobs.init(threads);
+		std::vector<double> partialSums(elementCount / grainSize, 0.0);
+		auto start = std::chrono::high_resolution_clock::now();
+		jobs.parallelFor(elementCount, grainSize, [&partialSums](uint32_t first, uint32_t count) {
+			double sum = 0.0;
+			for (uint32_t i = first; i < first + count; i++) {
+				sum += std::sqrt(static_cast<double>(i));
+			}
+			partialSums[first / grainSize] = sum;
+		});
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		jobs.destroy();
+
+		if (threads == 1) singleThreadMilliseconds = milliseconds;
+		// efficiency is the speedup divided by the thread count, 100% is perfect scaling
+		std::cout << " " << threads << (threads == 1 ? " thread " : " threads ") << milliseconds << " ms ("
+			<< 100.0 * singleThreadMilliseconds / (milliseconds * threads) << "%)";
+	}
+	std::cout << "\n";
+}
+
+// CPU side counters of the render loop, a frame benchmark prints how much they grew per frame
+struct FrameCounters {
+	uint64_t drawnFrames = 0;
+	double updateMicroseconds = 0.0; // spent writing the frames' constants
+	double recordMicroseconds = 0.0; // spent recording command buffers
+	uint64_t commandBufferRecordings = 0;
+};
+
+// draws framesPerVariant frames with every variant of the scene's pipeline in turn, prints the frame time of each and
+// restores the scene's own pipeline at the end
+// a variant's pipeline is compiled before its frames begin, they include neither a compile nor the fallback pipeline
+//
+//   benchmark.init("permutation benchmark", 300, variants, restore);
+//   benchmark.step(counters, sceneDesc, pipelines);   // every frame, before the scene's pipeline is requested
+class FrameBenchmark {
+public:
+	struct Variant {
+		std::string name;
+		std::function<void(GraphicsPipelineDesc& desc)> apply; // turns the scene's description into the variant's
+	};
+
+	// printCpuTimes adds the update and record time per frame and how many command buffers were recorded
+	void init(std::string name, uint64_t framesPerVariant, std::vector<Variant> variants,
+		std::function<void(GraphicsPipelineDesc& desc)> restore, bool printCpuTimes = false)
+	{
+		m_name = std::move(name);
+		m_framesPerVariant = framesPerVariant;
+		m_variants = std::move(variants);
+		m_restore = std::move(restore);
+		m_printCpuTimes = printCpuTimes;
+		m_step = 0;
+	}
+
+	// switches sceneDesc to the next variant once the current one has drawn its frames
+	void step(const FrameCounters& counters, GraphicsPipelineDesc& sceneDesc, PipelineRegistry& pipelines)
+	{
+		if (m_variants.empty() || m_step > m_variants.size()) {
+			return;
+		}
+		auto now = std::chrono::high_resolution_clock::now();
+		if (m_step > 0) {
+			uint64_t frames = counters.drawnFrames - m_start.drawnFrames;
+			if (frames < m_framesPerVariant) {
+				return;
+			}
+			double milliseconds = std::chrono::duration<double, std::milli>(now - m_startTime).count();
+			std::cout << m_name << ": " << m_variants[m_step - 1].name << ": " << milliseconds / frames << " ms per frame";
+			if (m_printCpuTimes) {
+				std::cout << ", update " << (counters.updateMicroseconds - m_start.updateMicroseconds) / frames << " us, record "
+					<< (counters.recordMicroseconds - m_start.recordMicroseconds) / frames << " us per frame ("
+					<< double(counters.commandBufferRecordings - m_start.commandBufferRecordings) / frames
+					<< " command buffers recorded per frame)";
+			}
+			std::cout << "\n";
+		}
+		if (m_step < m_variants.size()) {
+			m_variants[m_step].apply(sceneDesc);
+			pipelines.compileNow(sceneDesc);
+		}
+		else {
+			m_restore(sceneDesc);
+		}
+		m_step++;
+		m_start = counters;
+		m_startTime = std::chrono::high_resolution_clock::now();
+	}
+
+private:
+	std::string m_name;
+	uint64_t m_framesPerVariant = 0;
+	std::vector<Variant> m_variants;
+	std::function<void(GraphicsPipelineDesc& desc)> m_restore;
+	bool m_printCpuTimes = false;
+	size_t m_step = 0; // 1 + the index of the variant being measured, past the last one once done
+	FrameCounters m_start; // the counters when the current variant began
+	std::chrono::high_resolution_clock::time_point m_startTime;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include "MemoryAllocator.h"
+
+// Vulkan objects can only be destroyed once no pending GPU work uses them anymore. Instead of waiting for the device
+// to go idle, an object is retired together with the GPU timeline value of the last submission which used it and is
+// destroyed once the timeline has reached that value.
+//
+//   deletionQueue.retireFramebuffer(framebuffer, timeline.submittedValue());   // anything submitted so far may use it
+//   ...
+//   deletionQueue.collect(timeline.completedValue());                          // once per frame
+
+struct DeferredDeletionStats {
+	uint32_t depth = 0; // objects waiting to be destroyed
+	uint32_t peakDepth = 0; // most objects which ever waited at once
+	uint64_t retired = 0; // objects handed to the queue so far
+	uint64_t destroyed = 0; // objects destroyed so far
+	uint64_t idleStallsAvoided = 0; // places which would have called vkDeviceWaitIdle without the queue
+};
+
+class DeferredDeletionQueue {
+public:
+	void init(VkDevice device, DeviceMemoryAllocator& allocator)
+	{
+		m_device = device;
+		m_allocator = &allocator;
+	}
+
+	// lastUse is the timeline value of the last submission which uses the object
+	void retireBuffer(VkBuffer buffer, MemoryAllocation memory, uint64_t lastUse)
+	{
+		retire(lastUse, [this, buffer, memory]() mutable {
+			vkDestroyBuffer(m_device, buffer, nullptr);
+			m_allocator->free(memory);
+		});
+	}
+	void retireImage(VkImage image, MemoryAllocation memory, uint64_t lastUse)
+	{
+		retire(lastUse, [this, image, memory]() mutable {
+			vkDestroyImage(m_device, image, nullptr);
+			m_allocator->free(memory);
+		});
+	}
+	void retireImageView(VkImageView imageView, uint64_t lastUse)
+	{
+		retire(lastUse, [this, imageView]() { vkDestroyImageView(m_device, imageView, nullptr); });
+	}
+	void retireFramebuffer(VkFramebuffer framebuffer, uint64_t lastUse)
+	{
+		retire(lastUse, [this, framebuffer]() { vkDestroyFramebuffer(m_device, framebuffer, nullptr); });
+	}
+	void retirePipeline(VkPipeline pipeline, uint64_t lastUse)
+	{
+		retire(lastUse, [this, pipeline]() { vkDestroyPipeline(m_device, pipeline, nullptr); });
+	}
+	void retireSwapchain(VkSwapchainKHR swapchain, uint64_t lastUse)
+	{
+		retire(lastUse, [this, swapchain]() { vkDestroySwapchainKHR(m_device, swapchain, nullptr); });
+	}
+
+	// destroys every object whose last use has completed, returns how many were destroyed
+	uint32_t collect(uint64_t completedValue)
+	{
+		// retire values are not guaranteed to be in order, so look at every entry
+		uint32_t count = 0;
+		for (auto it = m_entries.begin(); it != m_entries.end();)
+		{
+			if (it->lastUse <= completedValue)
+			{
+				it->destroy();
+				it = m_entries.erase(it);
+				count++;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		m_stats.destroyed += count;
+		return count;
+	}
+
+	// destroys everything, only valid once the device is idle (at shutdown)
+	void flush()
+	{
+		collect(UINT64_MAX);
+	}
+
+	// the caller got away without a vkDeviceWaitIdle thanks to the queue
+	void countAvoidedIdleStall()
+	{
+		m_stats.idleStallsAvoided++;
+	}
+
+	DeferredDeletionStats stats() const
+	{
+		DeferredDeletionStats stats = m_stats;
+		stats.depth = static_cast<uint32_t>(m_entries.size());
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		DeferredDeletionStats current = stats();
+		out << "deferred deletion queue: " << current.depth << " waiting (peak " << current.peakDepth << "), "
+			<< current.retired << " retired, " << current.destroyed << " destroyed, "
+			<< current.idleStallsAvoided << " device idle stalls avoided\n";
+	}
+
+private:
+	struct Entry {
+		uint64_t lastUse;
+		std::function<void()> destroy;
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceMemoryAllocator* m_allocator = nullptr;
+	std::deque<Entry> m_entries;
+	DeferredDeletionStats m_stats;
+
+	void retire(uint64_t lastUse, std::function<void()> destroy)
+	{
+		m_entries.push_back({ lastUse, std::move(destroy) });
+		m_stats.retired++;
+		m_stats.peakDepth = std::max(m_stats.peakDepth, static_cast<uint32_t>(m_entries.size()));
+	}
+};
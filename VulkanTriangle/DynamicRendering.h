@@ -0,0 +1,174 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+
+// Vulkan 1.3 dynamic rendering: rendering begins directly on image views, so there is no VkRenderPass and no VkFramebuffer
+// to create (or to rebuild when the swap chain is resized)
+//
+// without a render pass nobody moves the images between layouts, begin() and end() record the synchronization2 barriers
+// the render pass used to imply:
+//   begin: color and depth   UNDEFINED -> attachment (after the previous frame's writes to them)
+//          swap chain image  UNDEFINED -> color attachment (after the acquire semaphore, which waits at color output)
+//   end:   swap chain image  color attachment -> present (after the MSAA resolve wrote it)
+//
+//   if (DynamicRendering::querySupport(instance, apiVersion, physicalDevice)) dynamicRendering.enable(deviceCreateInfo);
+//   ...vkCreateDevice...
+//   dynamicRendering.init(device);
+//   dynamicRendering.begin(commandBuffer, target, 0); ...draws... dynamicRendering.end(commandBuffer, target);
+//
+// the commands are looked up at runtime, so the application still starts with a Vulkan 1.0 loader
+
+// the images of one frame: multisampled color and depth, resolved into the swap chain image
+struct DynamicRenderTarget {
+	VkImage colorImage = VK_NULL_HANDLE;
+	VkImageView colorView = VK_NULL_HANDLE;
+	VkImage depthImage = VK_NULL_HANDLE;
+	VkImageView depthView = VK_NULL_HANDLE;
+	VkImageAspectFlags depthAspects = VK_IMAGE_ASPECT_DEPTH_BIT; // with the stencil bit if the format has one
+	VkImage presentImage = VK_NULL_HANDLE;
+	VkImageView presentView = VK_NULL_HANDLE;
+	VkExtent2D extent{};
+	VkClearValue clearColor{};
+	VkClearValue clearDepth{};
+};
+
+class DynamicRendering {
+public:
+	// true if the instance and the device are Vulkan 1.3 and the device has dynamic rendering and synchronization2
+	static bool querySupport(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (instanceApiVersion < VK_API_VERSION_1_3 || properties.apiVersion < VK_API_VERSION_1_3)
+		{
+			return false;
+		}
+		auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2"));
+		if (getFeatures2 == nullptr)
+		{
+			return false;
+		}
+		VkPhysicalDeviceVulkan13Features vulkan13Features{};
+		vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+		VkPhysicalDeviceFeatures2 features{};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &vulkan13Features;
+		getFeatures2(physicalDevice, &features);
+		return vulkan13Features.dynamicRendering && vulkan13Features.synchronization2;
+	}
+
+	// turns the features on, createInfo has to be used before this object goes away
+	void enable(VkDeviceCreateInfo& createInfo)
+	{
+		m_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+		m_features.dynamicRendering = VK_TRUE;
+		m_features.synchronization2 = VK_TRUE;
+		m_features.pNext = const_cast<void*>(createInfo.pNext);
+		createInfo.pNext = &m_features;
+	}
+
+	void init(VkDevice device)
+	{
+		m_beginRendering = reinterpret_cast<PFN_vkCmdBeginRendering>(vkGetDeviceProcAddr(device, "vkCmdBeginRendering"));
+		m_endRendering = reinterpret_cast<PFN_vkCmdEndRendering>(vkGetDeviceProcAddr(device, "vkCmdEndRendering"));
+		m_pipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2"));
+		if (m_beginRendering == nullptr || m_endRendering == nullptr || m_pipelineBarrier2 == nullptr) {
+			throw std::runtime_error("failed to load dynamic rendering commands!");
+		}
+	}
+
+	// moves the images into their attachment layouts and begins rendering to them, everything is cleared
+	// (flags: VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT if the draws come from secondary command buffers)
+	void begin(VkCommandBuffer commandBuffer, const DynamicRenderTarget& target, VkRenderingFlags flags) const
+	{
+		VkImageMemoryBarrier2 barriers[3]{};
+		// the previous frame may still be writing the shared multisampled images
+		barriers[0] = barrier(target.colorImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		barriers[1] = barrier(target.depthImage, target.depthAspects, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		// the presentation engine is done with the swap chain image once the acquire semaphore (waited on at color output) signals
+		barriers[2] = barrier(target.presentImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		pipelineBarrier(commandBuffer, barriers, 3);
+
+		// the multisampled color is resolved into the swap chain image at the end, neither it nor depth is needed afterwards
+		VkRenderingAttachmentInfo colorAttachment{};
+		colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		colorAttachment.imageView = target.colorView;
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+		colorAttachment.resolveImageView = target.presentView;
+		colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		colorAttachment.clearValue = target.clearColor;
+
+		VkRenderingAttachmentInfo depthAttachment{};
+		depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		depthAttachment.imageView = target.depthView;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.clearValue = target.clearDepth;
+
+		VkRenderingInfo renderingInfo{};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+		renderingInfo.flags = flags;
+		renderingInfo.renderArea = { { 0, 0 }, target.extent };
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments = &colorAttachment;
+		renderingInfo.pDepthAttachment = &depthAttachment;
+		m_beginRendering(commandBuffer, &renderingInfo);
+	}
+
+	// ends rendering and hands the swap chain image to presentation
+	void end(VkCommandBuffer commandBuffer, const DynamicRenderTarget& target) const
+	{
+		m_endRendering(commandBuffer);
+		// the resolve writes the swap chain image in the color output stage, the present semaphore waits for the whole submit
+		VkImageMemoryBarrier2 presentBarrier = barrier(target.presentImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		pipelineBarrier(commandBuffer, &presentBarrier, 1);
+	}
+
+private:
+	VkPhysicalDeviceVulkan13Features m_features{};
+	PFN_vkCmdBeginRendering m_beginRendering = nullptr;
+	PFN_vkCmdEndRendering m_endRendering = nullptr;
+	PFN_vkCmdPipelineBarrier2 m_pipelineBarrier2 = nullptr;
+
+	static VkImageMemoryBarrier2 barrier(VkImage image, VkImageAspectFlags aspects, VkImageLayout newLayout,
+		VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess,
+		VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		VkImageMemoryBarrier2 imageBarrier{};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+		imageBarrier.srcStageMask = srcStages;
+		imageBarrier.srcAccessMask = srcAccess;
+		imageBarrier.dstStageMask = dstStages;
+		imageBarrier.dstAccessMask = dstAccess;
+		imageBarrier.oldLayout = oldLayout; // UNDEFINED: the old contents are cleared anyway
+		imageBarrier.newLayout = newLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = image;
+		imageBarrier.subresourceRange = { aspects, 0, 1, 0, 1 };
+		return imageBarrier;
+	}
+
+	void pipelineBarrier(VkCommandBuffer commandBuffer, const VkImageMemoryBarrier2* barriers, uint32_t count) const
+	{
+		VkDependencyInfo dependencyInfo{};
+		dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+		dependencyInfo.imageMemoryBarrierCount = count;
+		dependencyInfo.pImageMemoryBarriers = barriers;
+		m_pipelineBarrier2(commandBuffer, &dependencyInfo);
+	}
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+// SPIR-V compiled into the executable, so startup reads no shader files and works from any working directory
+//
+// shaders/compiler.bat writes every shader twice, the .spv file and a .spv.inc file with the same words as a C initializer
+// list (glslc -mfmt=num), which is included below, and validates the module with spirv-val
+// neither is checked in: the project compiles a shader whenever its source is newer than its outputs (a custom build
+// step per shader), so the embedded code cannot fall behind the GLSL, and a shader which fails to compile fails the build
+//
+//   SpirvCode vert = embeddedShader("shaders/vert.spv");   // the name pipeline descriptions use
+//   createInfo.pCode = vert.words;
+//   createInfo.codeSize = vert.size();
+//
+// the arrays are uint32_t, so pCode is as aligned as VkShaderModuleCreateInfo wants it without a copy
+
+// words of a SPIR-V module somebody else owns
+struct SpirvCode {
+	const uint32_t* words = nullptr;
+	size_t wordCount = 0;
+
+	size_t size() const { return wordCount * sizeof(uint32_t); } // bytes
+};
+
+namespace embedded_shaders {
+	inline constexpr uint32_t vert[] = {
+#include "shaders/vert.spv.inc"
+	};
+	inline constexpr uint32_t frag[] = {
+#include "shaders/frag.spv.inc"
+	};
+	inline constexpr uint32_t mvpVert[] = {
+#include "shaders/mvp_vert.spv.inc"
+	};
+
+	struct Entry {
+		const char* spirvPath;
+		SpirvCode code;
+	};
+	inline constexpr Entry entries[] = {
+		{ "shaders/vert.spv", { vert, std::size(vert) } },
+		{ "shaders/frag.spv", { frag, std::size(frag) } },
+		{ "shaders/mvp_vert.spv", { mvpVert, std::size(mvpVert) } },
+	};
+}
+
+// the embedded code of a SPIR-V file, throws for files compiler.bat does not embed
+inline SpirvCode embeddedShader(const std::string& spirvPath)
+{
+	for (const embedded_shaders::Entry& entry : embedded_shaders::entries)
+	{
+		if (spirvPath == entry.spirvPath)
+		{
+			return entry.code;
+		}
+	}
+	throw std::runtime_error("failed to find embedded shader " + spirvPath + "!");
+}
+
+// bytes of SPIR-V in the executable
+inline size_t embeddedShaderBytes()
+{
+	size_t bytes = 0;
+	for (const embedded_shaders::Entry& entry : embedded_shaders::entries)
+	{
+		bytes += entry.code.size();
+	}
+	return bytes;
+}
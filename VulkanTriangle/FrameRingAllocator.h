@@ -0,0 +1,206 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "MemoryAllocator.h"
+
+// transient per frame GPU data (uniforms, instance data, dynamic vertices) lives in one persistently mapped buffer
+// the buffer is cut into one region per frame in flight, every region is a linear allocator:
+//
+//   | frame 0: constants | linear ... | frame 1: constants | linear ... |
+//
+// a region is handed out again once the GPU timeline has reached the value of the frame which used it last,
+// so there is nothing to free
+// the constants at the start of every region never move, descriptor sets can point at them once and for all
+
+// copies size bytes from src to dst
+// mapped memory is often write combined and uncached, whole aligned 16 byte stores fill its write buffers without ever
+// reading it back, memcpy may start and end with partial stores
+// ring allocations and alignas(16) structs are 16 byte aligned, any other dst is left to memcpy, a tail of less than
+// 16 bytes too
+inline void copyToMapped(void* dst, const void* src, size_t size)
+{
+#if defined(_M_X64) || defined(__SSE2__)
+	if (reinterpret_cast<uintptr_t>(dst) % 16 != 0)
+	{
+		memcpy(dst, src, size);
+		return;
+	}
+	const float* from = static_cast<const float*>(src);
+	float* to = static_cast<float*>(dst);
+	size_t wholeBytes = size / 16 * 16;
+	for (size_t i = 0; i < wholeBytes / sizeof(float); i += 4)
+	{
+		_mm_store_ps(to + i, _mm_loadu_ps(from + i));
+	}
+	memcpy(static_cast<char*>(dst) + wholeBytes, static_cast<const char*>(src) + wholeBytes, size - wholeBytes);
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+// a sub-range of the ring buffer
+struct RingAllocation {
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0; // offset inside buffer (use it for descriptors, dynamic offsets or vkCmdBindVertexBuffers)
+	VkDeviceSize size = 0;
+	void* data = nullptr; // where the CPU writes the data
+};
+
+struct FrameRingStats {
+	VkDeviceSize frameCapacity = 0; // bytes available to allocate() per frame
+	VkDeviceSize lastFrameBytes = 0; // bytes allocated by the last finished frame
+	VkDeviceSize highWaterMark = 0; // most bytes any frame ever allocated (including alignment padding)
+	uint64_t allocationCount = 0; // total number of allocations
+};
+
+class FrameRingAllocator {
+public:
+	// constantsSize bytes at the start of every region are reserved for the per frame constants,
+	// frameSize is the total size of every region (constants included)
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, DeviceMemoryAllocator& allocator,
+		uint32_t frameCount, VkDeviceSize constantsSize, VkDeviceSize frameSize)
+	{
+		m_device = device;
+		m_allocator = &allocator;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		m_defaultAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+
+		m_constantsSize = alignUp(constantsSize, m_defaultAlignment);
+		m_frameSize = alignUp(frameSize, m_defaultAlignment);
+		if (m_constantsSize > m_frameSize)
+		{
+			throw std::invalid_argument("frame ring allocator: constants do not fit into a frame");
+		}
+		m_frames.resize(frameCount);
+
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = m_frameSize * frameCount;
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &m_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame ring buffer!");
+		}
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(m_device, m_buffer, &memRequirements);
+		m_memory = m_allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MemoryResourceKind::Linear, false);
+		vkBindBufferMemory(m_device, m_buffer, m_memory.memory, m_memory.offset);
+	}
+
+	void destroy()
+	{
+		vkDestroyBuffer(m_device, m_buffer, nullptr);
+		m_allocator->free(m_memory);
+	}
+
+	// starts using the region of frameIndex again, everything allocated from it the last time is gone
+	// completedValue is the value the GPU timeline has reached, it must cover the last submission which used the region
+	void beginFrame(uint32_t frameIndex, uint64_t completedValue)
+	{
+		FrameRegion& region = m_frames[frameIndex];
+		if (region.lastUse > completedValue)
+		{
+			throw std::logic_error("frame ring allocator: region reused while the GPU may still read it");
+		}
+		if (region.used > 0)
+		{
+			m_stats.lastFrameBytes = region.used;
+		}
+		region.used = 0;
+		m_currentFrame = frameIndex;
+	}
+
+	// the current frame was submitted as timeline value submittedValue, its region is not reused before that value is reached
+	void endFrame(uint64_t submittedValue)
+	{
+		m_frames[m_currentFrame].lastUse = submittedValue;
+	}
+
+	// aligned sub-range of the current frame's region, valid until the frame's timeline value is reached
+	// alignment 0 means minUniformBufferOffsetAlignment, which is good for uniforms, vertices and indices alike
+	RingAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0)
+	{
+		FrameRegion& region = m_frames[m_currentFrame];
+		// align the absolute offset inside the buffer, that is what the device sees
+		VkDeviceSize base = regionOffset(m_currentFrame) + m_constantsSize;
+		VkDeviceSize start = alignUp(base + region.used, alignment == 0 ? m_defaultAlignment : alignment) - base;
+		if (start + size > m_frameSize - m_constantsSize)
+		{
+			throw std::runtime_error("frame ring allocator is out of space, increase its frame size!");
+		}
+		region.used = start + size;
+		m_stats.highWaterMark = std::max(m_stats.highWaterMark, region.used);
+		m_stats.allocationCount++;
+
+		RingAllocation allocation;
+		allocation.buffer = m_buffer;
+		allocation.offset = base + start;
+		allocation.size = size;
+		allocation.data = static_cast<char*>(m_memory.mappedData) + allocation.offset;
+		return allocation;
+	}
+
+	// the fixed constants block at the start of the region of frameIndex
+	RingAllocation frameConstants(uint32_t frameIndex) const
+	{
+		RingAllocation allocation;
+		allocation.buffer = m_buffer;
+		allocation.offset = regionOffset(frameIndex);
+		allocation.size = m_constantsSize;
+		allocation.data = static_cast<char*>(m_memory.mappedData) + allocation.offset;
+		return allocation;
+	}
+
+	VkBuffer buffer() const { return m_buffer; }
+
+	FrameRingStats stats() const
+	{
+		FrameRingStats stats = m_stats;
+		stats.frameCapacity = m_frameSize - m_constantsSize;
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		FrameRingStats current = stats();
+		out << "frame ring allocator: high water mark " << current.highWaterMark << " of " << current.frameCapacity
+			<< " bytes per frame, last frame " << current.lastFrameBytes << " bytes, " << current.allocationCount << " allocations\n";
+	}
+
+private:
+	struct FrameRegion {
+		VkDeviceSize used = 0; // bytes handed out by allocate() since the region was last reclaimed
+		uint64_t lastUse = 0; // timeline value of the last submission which read the region
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceMemoryAllocator* m_allocator = nullptr;
+	VkBuffer m_buffer = VK_NULL_HANDLE;
+	MemoryAllocation m_memory;
+	VkDeviceSize m_defaultAlignment = 256;
+	VkDeviceSize m_constantsSize = 0;
+	VkDeviceSize m_frameSize = 0;
+	uint32_t m_currentFrame = 0;
+	std::vector<FrameRegion> m_frames;
+	FrameRingStats m_stats;
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+	VkDeviceSize regionOffset(uint32_t frameIndex) const
+	{
+		return m_frameSize * frameIndex;
+	}
+};
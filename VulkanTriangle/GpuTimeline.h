@@ -0,0 +1,288 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+// one monotonically increasing counter for all GPU work: every submit made through the timeline signals the next value,
+// "has GPU work X finished" becomes "is the completed value >= X", which every subsystem can ask cheaply
+//
+// with timeline semaphores (Vulkan 1.2 or VK_KHR_timeline_semaphore) the counter is the semaphore's payload,
+// without them every submit gets a fence from a small pool and the completed value is derived from the fences
+//
+// all submissions made through one timeline have to go to the same queue, so they signal their values in order
+
+enum class GpuTimelineSupport {
+	None, // fall back to fences
+	Extension, // VK_KHR_timeline_semaphore on a Vulkan 1.1 device
+	Core // Vulkan 1.2
+};
+
+struct GpuTimelineStats {
+	uint64_t submits = 0; // submissions made through the timeline
+	uint64_t waits = 0; // wait() calls which actually had to block
+	uint32_t fenceCount = 0; // fences created by the fallback
+};
+
+class GpuTimeline {
+public:
+	// what the device supports, instanceApiVersion is the apiVersion the instance was created with
+	static GpuTimelineSupport querySupport(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice)
+	{
+		// vkGetPhysicalDeviceFeatures2 is needed to ask for the feature, it is core in Vulkan 1.1
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (instanceApiVersion < VK_API_VERSION_1_1 || properties.apiVersion < VK_API_VERSION_1_1)
+		{
+			return GpuTimelineSupport::None;
+		}
+		// looked up at runtime so the application still starts with a Vulkan 1.0 loader
+		auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2"));
+		if (getFeatures2 == nullptr)
+		{
+			return GpuTimelineSupport::None;
+		}
+
+		GpuTimelineSupport support = GpuTimelineSupport::None;
+		if (instanceApiVersion >= VK_API_VERSION_1_2 && properties.apiVersion >= VK_API_VERSION_1_2)
+		{
+			support = GpuTimelineSupport::Core;
+		}
+		else
+		{
+			uint32_t extensionCount = 0;
+			vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+			std::vector<VkExtensionProperties> extensions(extensionCount);
+			vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+			for (const VkExtensionProperties& extension : extensions)
+			{
+				if (strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0)
+				{
+					support = GpuTimelineSupport::Extension;
+				}
+			}
+		}
+		if (support == GpuTimelineSupport::None)
+		{
+			return support;
+		}
+
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		VkPhysicalDeviceFeatures2 features{};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &timelineFeatures;
+		getFeatures2(physicalDevice, &features);
+		return timelineFeatures.timelineSemaphore ? support : GpuTimelineSupport::None;
+	}
+
+	// the device has to be created with the timelineSemaphore feature (and the extension for Extension) enabled
+	void init(VkDevice device, GpuTimelineSupport support)
+	{
+		m_device = device;
+		m_support = support;
+		if (m_support == GpuTimelineSupport::None)
+		{
+			return;
+		}
+
+		const bool core = m_support == GpuTimelineSupport::Core;
+		m_waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(vkGetDeviceProcAddr(m_device, core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+		m_getCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+			vkGetDeviceProcAddr(m_device, core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+		if (m_waitSemaphores == nullptr || m_getCounterValue == nullptr)
+		{
+			throw std::runtime_error("failed to load the timeline semaphore functions!");
+		}
+
+		VkSemaphoreTypeCreateInfo typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+		if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timeline semaphore!");
+		}
+	}
+
+	void destroy()
+	{
+		wait(m_submitted);
+		if (m_semaphore != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(m_device, m_semaphore, nullptr);
+			m_semaphore = VK_NULL_HANDLE;
+		}
+		for (VkFence fence : m_freeFences)
+		{
+			vkDestroyFence(m_device, fence, nullptr);
+		}
+		m_freeFences.clear();
+	}
+
+	// submits to queue, the returned value is reached once the submission has finished
+	// submitInfo can wait for and signal binary semaphores of its own
+	uint64_t submit(VkQueue queue, const VkSubmitInfo& submitInfo)
+	{
+		uint64_t value = m_submitted + 1;
+		if (m_support != GpuTimelineSupport::None)
+		{
+			// the timeline semaphore is signaled in addition to whatever the caller signals
+			std::vector<VkSemaphore> signalSemaphores(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+			signalSemaphores.push_back(m_semaphore);
+			std::vector<uint64_t> signalValues(signalSemaphores.size(), 0); // binary semaphores ignore their value
+			signalValues.back() = value;
+
+			VkTimelineSemaphoreSubmitInfo timelineInfo{};
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timelineInfo.pNext = submitInfo.pNext;
+			timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+			timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+			VkSubmitInfo timelineSubmitInfo = submitInfo;
+			timelineSubmitInfo.pNext = &timelineInfo;
+			timelineSubmitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+			timelineSubmitInfo.pSignalSemaphores = signalSemaphores.data();
+			if (vkQueueSubmit(queue, 1, &timelineSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit to the GPU timeline!");
+			}
+		}
+		else
+		{
+			VkFence fence = freeFence();
+			if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+				m_freeFences.push_back(fence);
+				throw std::runtime_error("failed to submit to the GPU timeline!");
+			}
+			m_pending.push_back({ value, fence });
+		}
+		m_submitted = value;
+		m_stats.submits++;
+		return value;
+	}
+
+	// every value up to the returned one has been reached (non blocking)
+	uint64_t completedValue()
+	{
+		if (m_support != GpuTimelineSupport::None)
+		{
+			uint64_t value = m_completed;
+			m_getCounterValue(m_device, m_semaphore, &value);
+			m_completed = value;
+		}
+		else
+		{
+			// pending fences are in submission order, a value only counts as completed if everything before it has too
+			while (!m_pending.empty() && vkGetFenceStatus(m_device, m_pending.front().fence) == VK_SUCCESS)
+			{
+				m_completed = m_pending.front().value;
+				m_freeFences.push_back(m_pending.front().fence);
+				m_pending.pop_front();
+			}
+		}
+		return m_completed;
+	}
+
+	bool isComplete(uint64_t value)
+	{
+		return value <= m_completed || value <= completedValue();
+	}
+
+	// blocks until value has been reached
+	void wait(uint64_t value)
+	{
+		if (value > m_submitted)
+		{
+			throw std::logic_error("GPU timeline: waiting for a value which has not been submitted");
+		}
+		if (isComplete(value))
+		{
+			return;
+		}
+		m_stats.waits++;
+		if (m_support != GpuTimelineSupport::None)
+		{
+			VkSemaphoreWaitInfo waitInfo{};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &m_semaphore;
+			waitInfo.pValues = &value;
+			m_waitSemaphores(m_device, &waitInfo, UINT64_MAX);
+		}
+		else
+		{
+			for (const PendingFence& pending : m_pending)
+			{
+				if (pending.value > value) break;
+				vkWaitForFences(m_device, 1, &pending.fence, VK_TRUE, UINT64_MAX);
+			}
+		}
+		completedValue();
+	}
+
+	// the value of the last submission
+	uint64_t submittedValue() const { return m_submitted; }
+	bool usesTimelineSemaphore() const { return m_support != GpuTimelineSupport::None; }
+
+	GpuTimelineStats stats() const
+	{
+		GpuTimelineStats stats = m_stats;
+		stats.fenceCount = static_cast<uint32_t>(m_freeFences.size() + m_pending.size());
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		GpuTimelineStats current = stats();
+		out << "GPU timeline (" << (m_support == GpuTimelineSupport::Core ? "timeline semaphore" :
+			m_support == GpuTimelineSupport::Extension ? "VK_KHR_timeline_semaphore" : "fences") << "): "
+			<< current.submits << " submits, " << current.waits << " blocking waits";
+		if (m_support == GpuTimelineSupport::None)
+		{
+			out << ", " << current.fenceCount << " fences";
+		}
+		out << "\n";
+	}
+
+private:
+	struct PendingFence {
+		uint64_t value;
+		VkFence fence;
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	GpuTimelineSupport m_support = GpuTimelineSupport::None;
+	VkSemaphore m_semaphore = VK_NULL_HANDLE;
+	PFN_vkWaitSemaphores m_waitSemaphores = nullptr;
+	PFN_vkGetSemaphoreCounterValue m_getCounterValue = nullptr;
+	uint64_t m_submitted = 0; // value of the last submission
+	uint64_t m_completed = 0; // every value up to this one has been reached
+	std::deque<PendingFence> m_pending; // fallback: fences of submissions which have not been seen completing yet
+	std::vector<VkFence> m_freeFences; // fallback: fences which can be used for the next submits
+	GpuTimelineStats m_stats;
+
+	VkFence freeFence()
+	{
+		// recycle fences of finished submissions first
+		completedValue();
+		if (!m_freeFences.empty())
+		{
+			VkFence fence = m_freeFences.back();
+			m_freeFences.pop_back();
+			vkResetFences(m_device, 1, &fence);
+			return fence;
+		}
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VkFence fence;
+		if (vkCreateFence(m_device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create GPU timeline fence!");
+		}
+		return fence;
+	}
+};
@@ -0,0 +1,311 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <chrono>
+
+// work stealing job scheduler shared by everything which wants to run on several cores
+// (command recording, asset import, culling, transform updates, ...)
+//
+// every thread has a deque of its own: it pushes and pops jobs at the back, idle threads steal from the front of the others,
+// so a thread mostly works on the jobs it spawned itself (which are still in its cache) and only takes the oldest,
+// usually biggest, jobs of the others
+//
+// dependencies are expressed with counters: every job run with a counter increments it and decrements it when it is done,
+// wait() runs other jobs until the counter drops to 0, so waiting never blocks a thread which could work
+// threads outside the system (a render thread, ...) share one more deque, the workers steal from it, but when such a thread
+// waits it only runs the jobs of the counter it waits for and sleeps otherwise, it never gets stuck in a long job
+// somebody else spawned
+//
+//   JobCounter counter;
+//   jobs.run([]() { importMesh(); }, &counter);
+//   jobs.run([]() { importTexture(); }, &counter);
+//   jobs.wait(counter);
+//
+//   jobs.parallelFor(objectCount, 256, [&](uint32_t first, uint32_t count) { cull(first, count); });
+
+struct JobCounter {
+	std::atomic<uint32_t> pending{ 0 }; // jobs which have been run with the counter and have not finished yet
+	std::mutex errorMutex;
+	std::exception_ptr error; // first exception one of the jobs threw since the last wait() for the counter
+
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+struct JobSystemStats {
+	uint32_t threadCount = 0; // including the thread which called init
+	uint64_t jobsRun = 0; // jobs finished so far
+	uint64_t steals = 0; // jobs taken from the deque of another thread
+};
+
+class JobSystem {
+public:
+	using Job = std::function<void()>;
+	// runs elements [first, first + count)
+	using Range = std::function<void(uint32_t first, uint32_t count)>;
+
+	// threadCount includes the calling thread, which becomes thread 0 and works on jobs whenever it waits,
+	// 0 uses every hardware thread
+	void init(uint32_t threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		m_quit = false;
+		m_threadCount = threadCount;
+		// the last deque is the one of the threads outside the system
+		for (uint32_t i = 0; i <= threadCount; i++)
+		{
+			m_queues.push_back(std::make_unique<Queue>());
+		}
+		t_system = this;
+		t_index = 0;
+		for (uint32_t i = 1; i < threadCount; i++)
+		{
+			m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+		}
+	}
+
+	// jobs which are still queued are dropped, wait for their counters first
+	void destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_quit = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& thread : m_threads)
+		{
+			thread.join();
+		}
+		m_threads.clear();
+		m_queues.clear();
+		if (t_system == this) t_system = nullptr;
+	}
+
+	// queues job on the deque of the calling thread (threads outside the system share one)
+	// a job run without a counter has nobody to throw to, its exceptions are printed
+	void run(Job job, JobCounter* counter = nullptr)
+	{
+		if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+		// counted before it can be taken, so the count never drops below the jobs really queued
+		m_queued.fetch_add(1, std::memory_order_release);
+		{
+			Queue& queue = *m_queues[currentIndex()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back({ std::move(job), counter });
+		}
+		// taking the sleep mutex makes sure a worker which just found nothing to do is already waiting and gets the notification
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+		}
+		m_wake.notify_one();
+	}
+
+	// runs jobs until every job run with counter has finished, rethrows the first exception one of them threw
+	// (threads outside the system only run the jobs of counter)
+	void wait(JobCounter& counter)
+	{
+		if (t_system == this)
+		{
+			while (!counter.done())
+			{
+				if (!runOne(t_index))
+				{
+					// the remaining jobs are running on other threads
+					std::this_thread::yield();
+				}
+			}
+		}
+		else
+		{
+			while (!counter.done())
+			{
+				if (!runCounted(counter))
+				{
+					// the remaining jobs are running on the workers, a job of theirs may still spawn one with counter
+					std::unique_lock<std::mutex> lock(m_doneMutex);
+					m_counterDone.wait_for(lock, std::chrono::milliseconds(1), [&counter]() { return counter.done(); });
+				}
+			}
+		}
+		std::exception_ptr error;
+		{
+			std::lock_guard<std::mutex> lock(counter.errorMutex);
+			std::swap(error, counter.error);
+		}
+		if (error) std::rethrow_exception(error);
+	}
+
+	// cuts [0, count) into chunks of grainSize elements, runs them as jobs and waits for them
+	void parallelFor(uint32_t count, uint32_t grainSize, const Range& body)
+	{
+		grainSize = std::max(grainSize, 1u);
+		JobCounter counter;
+		for (uint32_t first = 0; first < count; first += grainSize)
+		{
+			uint32_t chunk = std::min(grainSize, count - first);
+			run([&body, first, chunk]() { body(first, chunk); }, &counter);
+		}
+		wait(counter);
+	}
+
+	uint32_t threadCount() const { return m_threadCount; }
+
+	JobSystemStats stats() const
+	{
+		JobSystemStats stats;
+		stats.threadCount = threadCount();
+		stats.jobsRun = m_jobsRun.load(std::memory_order_relaxed);
+		stats.steals = m_steals.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		JobSystemStats current = stats();
+		out << "job system: " << current.threadCount << " threads, " << current.jobsRun << " jobs run, "
+			<< current.steals << " stolen\n";
+	}
+
+private:
+	struct Entry {
+		Job job;
+		JobCounter* counter;
+	};
+	// a plain deque behind a mutex, the lock is only contended while somebody steals
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Entry> jobs;
+	};
+
+	// one per thread, [0] belongs to the thread which called init, [m_threadCount] to the threads outside the system
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	uint32_t m_threadCount = 0;
+	std::vector<std::thread> m_threads;
+	std::atomic<uint32_t> m_queued{ 0 }; // jobs in all deques together
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake; // jobs have been queued (or the workers have to quit)
+	bool m_quit = false;
+	std::mutex m_doneMutex;
+	std::condition_variable m_counterDone; // a counter has dropped to 0 (threads outside the system wait for that)
+	std::atomic<uint64_t> m_jobsRun{ 0 };
+	std::atomic<uint64_t> m_steals{ 0 };
+
+	// which thread of which system the calling thread is
+	static inline thread_local JobSystem* t_system = nullptr;
+	static inline thread_local uint32_t t_index = 0;
+
+	uint32_t currentIndex() const { return t_system == this ? t_index : m_threadCount; }
+
+	// runs one job, its own newest first, otherwise the oldest of another thread, false if there was nothing to run
+	bool runOne(uint32_t index)
+	{
+		Entry entry;
+		bool found = false;
+		{
+			Queue& own = *m_queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				entry = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				found = true;
+			}
+		}
+		for (uint32_t i = 1; !found && i < m_queues.size(); i++)
+		{
+			Queue& victim = *m_queues[(index + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				entry = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				found = true;
+				m_steals.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		if (!found) return false;
+		m_queued.fetch_sub(1, std::memory_order_relaxed);
+		execute(entry);
+		return true;
+	}
+
+	// runs the oldest queued job of counter, wherever it was queued, false if there is none
+	bool runCounted(JobCounter& counter)
+	{
+		for (std::unique_ptr<Queue>& queue : m_queues)
+		{
+			Entry entry;
+			{
+				std::lock_guard<std::mutex> lock(queue->mutex);
+				auto it = std::find_if(queue->jobs.begin(), queue->jobs.end(), [&counter](const Entry& queued) { return queued.counter == &counter; });
+				if (it == queue->jobs.end()) continue;
+				entry = std::move(*it);
+				queue->jobs.erase(it);
+			}
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+			execute(entry);
+			return true;
+		}
+		return false;
+	}
+
+	void execute(Entry& entry)
+	{
+		try {
+			entry.job();
+		}
+		catch (const std::exception& e) {
+			fail(entry.counter, e.what());
+		}
+		catch (...) {
+			fail(entry.counter, "unknown exception");
+		}
+		m_jobsRun.fetch_add(1, std::memory_order_relaxed);
+		// once it drops to 0 the waiter may destroy the counter, it is not touched after that
+		if (entry.counter && entry.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_doneMutex);
+			}
+			m_counterDone.notify_all();
+		}
+	}
+
+	// keeps the first exception of counter for its wait(), called from the catch block
+	static void fail(JobCounter* counter, const char* what)
+	{
+		if (!counter)
+		{
+			std::cerr << "job system: job failed: " << what << std::endl;
+			return;
+		}
+		std::lock_guard<std::mutex> lock(counter->errorMutex);
+		if (!counter->error) counter->error = std::current_exception();
+	}
+
+	void workerLoop(uint32_t index)
+	{
+		t_system = this;
+		t_index = index;
+		while (true)
+		{
+			if (runOne(index)) continue;
+
+			std::unique_lock<std::mutex> lock(m_sleepMutex);
+			m_wake.wait(lock, [this]() { return m_quit || m_queued.load(std::memory_order_acquire) > 0; });
+			if (m_quit) return;
+		}
+	}
+};
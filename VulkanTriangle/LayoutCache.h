@@ -0,0 +1,165 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+#include "ShaderReflection.h"
+
+// descriptor set layouts and pipeline layouts, created once per distinct description and shared from then on
+//
+// two shaders which declare the same bindings get the same VkDescriptorSetLayout, and two pipelines whose shaders
+// declare the same interface get the same VkPipelineLayout, so descriptor sets bound for one stay valid for the other
+//
+//   std::vector<VkDescriptorSetLayout> setLayouts;
+//   VkPipelineLayout layout = layouts.pipelineLayout(reflection, setLayouts);   // everything the shaders declare
+//
+// safe to use from several threads (pipelines are built on job threads), everything lives until destroy()
+
+struct LayoutCacheStats {
+	uint32_t setLayouts = 0; // VkDescriptorSetLayouts created
+	uint32_t pipelineLayouts = 0; // VkPipelineLayouts created
+	uint64_t hits = 0; // requests answered with an existing layout
+};
+
+class LayoutCache {
+public:
+	void init(VkDevice device)
+	{
+		m_device = device;
+	}
+
+	void destroy()
+	{
+		for (auto& [key, layout] : m_pipelineLayouts)
+		{
+			vkDestroyPipelineLayout(m_device, layout, nullptr);
+		}
+		for (auto& [key, layout] : m_setLayouts)
+		{
+			vkDestroyDescriptorSetLayout(m_device, layout, nullptr);
+		}
+		m_pipelineLayouts.clear();
+		m_setLayouts.clear();
+	}
+
+	// the layout for these bindings, the order they come in does not matter
+	VkDescriptorSetLayout descriptorSetLayout(std::vector<VkDescriptorSetLayoutBinding> bindings)
+	{
+		std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+			return a.binding < b.binding;
+		});
+		std::vector<uint32_t> key;
+		for (const VkDescriptorSetLayoutBinding& binding : bindings)
+		{
+			if (binding.pImmutableSamplers != nullptr)
+			{
+				throw std::runtime_error("failed to cache descriptor set layout, immutable samplers are not supported!");
+			}
+			key.insert(key.end(), { binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags });
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto found = m_setLayouts.find(key);
+		if (found != m_setLayouts.end())
+		{
+			m_stats.hits++;
+			return found->second;
+		}
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		VkDescriptorSetLayout layout;
+		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
+		m_setLayouts.emplace(std::move(key), layout);
+		m_stats.setLayouts++;
+		return layout;
+	}
+
+	VkPipelineLayout pipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants)
+	{
+		std::vector<uint64_t> key;
+		for (VkDescriptorSetLayout setLayout : setLayouts)
+		{
+			key.push_back(reinterpret_cast<uint64_t>(setLayout));
+		}
+		key.push_back(UINT64_MAX); // separates the set layouts from the ranges
+		for (const VkPushConstantRange& range : pushConstants)
+		{
+			key.insert(key.end(), { range.stageFlags, range.offset, range.size });
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto found = m_pipelineLayouts.find(key);
+		if (found != m_pipelineLayouts.end())
+		{
+			m_stats.hits++;
+			return found->second;
+		}
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+		pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+		pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstants.size());
+		pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
+		VkPipelineLayout layout;
+		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+		m_pipelineLayouts.emplace(std::move(key), layout);
+		m_stats.pipelineLayouts++;
+		return layout;
+	}
+
+	// the pipeline layout for everything the shaders declare, setLayouts receives one layout per set
+	// (sets the shaders skip get an empty layout)
+	VkPipelineLayout pipelineLayout(const ShaderReflection& reflection, std::vector<VkDescriptorSetLayout>& setLayouts)
+	{
+		setLayouts.clear();
+		for (uint32_t set = 0; set < reflection.setCount(); set++)
+		{
+			setLayouts.push_back(descriptorSetLayout(reflection.setBindings(set)));
+		}
+		return pipelineLayout(setLayouts, reflection.pushConstants);
+	}
+
+	LayoutCacheStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		LayoutCacheStats current = stats();
+		out << "layout cache: " << current.setLayouts << " descriptor set layouts, " << current.pipelineLayouts << " pipeline layouts, "
+			<< current.hits << " requests shared an existing one\n";
+	}
+
+private:
+	// hashes the words of a key, two keys only share a layout if all words are equal
+	template<typename Word>
+	struct KeyHash {
+		size_t operator()(const std::vector<Word>& key) const
+		{
+			size_t seed = key.size();
+			for (Word word : key)
+			{
+				seed ^= std::hash<Word>()(word) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			}
+			return seed;
+		}
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	mutable std::mutex m_mutex; // guards the maps and m_stats
+	std::unordered_map<std::vector<uint32_t>, VkDescriptorSetLayout, KeyHash<uint32_t>> m_setLayouts; // binding, type, count, stages per binding
+	std::unordered_map<std::vector<uint64_t>, VkPipelineLayout, KeyHash<uint64_t>> m_pipelineLayouts; // set layouts, then push constant ranges
+	LayoutCacheStats m_stats;
+};
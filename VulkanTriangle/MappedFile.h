@@ -0,0 +1,165 @@
+#pragma once
+#include <string>
+#include <istream>
+#include <streambuf>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read only view of a whole file mapped into the address space, the OS pages it in as it is read and nothing is copied
+// into the heap (an ifstream read copies everything into a buffer of its own first)
+//
+//   MappedFile file(TEXTURE_PATH);                                   // throws if the file cannot be opened
+//   stbi_load_from_memory(file.data(), int(file.size()), ...);
+//   MappedFileStream stream(file);                                 // for parsers which want an std::istream
+//   tinyobj::LoadObj(..., &stream, ...);
+//
+// the view stays valid until the MappedFile goes away, every mapping is counted in MappedFile::stats()
+
+struct FileIoStats {
+	uint32_t files = 0; // files mapped
+	uint64_t bytes = 0; // their size together
+	double milliseconds = 0.0; // opening and mapping them, summed over all threads
+};
+
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	explicit MappedFile(const std::string& path)
+	{
+		auto openBegin = std::chrono::high_resolution_clock::now();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error("failed to open file " + path + "!");
+		}
+		LARGE_INTEGER size{};
+		GetFileSizeEx(file, &size);
+		m_size = static_cast<size_t>(size.QuadPart);
+		// an empty file cannot be mapped, there is nothing to read anyway
+		if (m_size > 0) {
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr) {
+				m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				CloseHandle(mapping); // the view keeps the mapping alive
+			}
+		}
+		CloseHandle(file);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0) {
+			throw std::runtime_error("failed to open file " + path + "!");
+		}
+		struct stat status {};
+		fstat(file, &status);
+		m_size = static_cast<size_t>(status.st_size);
+		if (m_size > 0) {
+			void* view = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+			m_data = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+		}
+		close(file); // the mapping keeps the file alive
+#endif
+		if (m_size > 0 && m_data == nullptr) {
+			throw std::runtime_error("failed to map file " + path + "!");
+		}
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - openBegin).count();
+		std::lock_guard<std::mutex> lock(totals().mutex);
+		totals().stats.files++;
+		totals().stats.bytes += m_size;
+		totals().stats.milliseconds += milliseconds;
+	}
+
+	~MappedFile()
+	{
+		unmap();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept : m_data(other.m_data), m_size(other.m_size)
+	{
+		other.m_data = nullptr;
+		other.m_size = 0;
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other) {
+			unmap();
+			m_data = other.m_data;
+			m_size = other.m_size;
+			other.m_data = nullptr;
+			other.m_size = 0;
+		}
+		return *this;
+	}
+
+	const uint8_t* data() const { return m_data; } // nullptr for empty files
+	size_t size() const { return m_size; }
+
+	// every file mapped so far
+	static FileIoStats stats()
+	{
+		std::lock_guard<std::mutex> lock(totals().mutex);
+		return totals().stats;
+	}
+
+	static void printStats(std::ostream& out)
+	{
+		FileIoStats current = stats();
+		out << "file i/o: " << current.files << " files mapped (" << current.bytes / 1024 << " KiB) in " << current.milliseconds
+			<< " ms, no heap copies of their bytes\n";
+	}
+
+private:
+	struct Totals {
+		std::mutex mutex;
+		FileIoStats stats;
+	};
+
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+	static Totals& totals()
+	{
+		static Totals instance;
+		return instance;
+	}
+
+	void unmap()
+	{
+		if (m_data == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+	}
+};
+
+// std::istream reading straight out of a mapped file, which has to outlive it
+class MappedFileStream : private std::streambuf, public std::istream {
+public:
+	explicit MappedFileStream(const MappedFile& file) : std::istream(static_cast<std::streambuf*>(this))
+	{
+		// the get area is never written through, streambuf just does not know about const
+		char* begin = const_cast<char*>(reinterpret_cast<const char*>(file.data()));
+		setg(begin, begin, begin + file.size());
+	}
+};
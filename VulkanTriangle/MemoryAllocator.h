@@ -0,0 +1,343 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+
+// device memory sub-allocation
+// instead of one vkAllocateMemory per buffer/image, large blocks are reserved per memory type and
+// resources are placed inside them. Placement inside a block uses a buddy allocator.
+
+// CPU side buddy allocator for one block, knows nothing about Vulkan so it can be exercised without a GPU
+// the block is split into power of two sized nodes, the smallest node (order 0) is minNodeSize bytes
+class BuddyAllocator {
+public:
+	static constexpr uint64_t INVALID_OFFSET = ~0ull;
+
+	BuddyAllocator(uint64_t blockSize, uint64_t minNodeSize)
+		: m_blockSize(blockSize), m_minNodeSize(minNodeSize)
+	{
+		if (!isPowerOfTwo(blockSize) || !isPowerOfTwo(minNodeSize) || minNodeSize > blockSize)
+		{
+			throw std::invalid_argument("buddy allocator: block and node sizes must be powers of two");
+		}
+		while ((m_minNodeSize << m_maxOrder) < m_blockSize) m_maxOrder++;
+		m_freeLists.resize(m_maxOrder + 1);
+		// at first the whole block is one free node
+		m_freeLists[m_maxOrder].insert(0);
+		m_freeBytes = m_blockSize;
+	}
+
+	// returns the offset of the allocation inside the block or INVALID_OFFSET if there is no room
+	// every node is aligned to its own size, so any power of two alignment up to the node size comes for free
+	uint64_t allocate(uint64_t size, uint64_t alignment)
+	{
+		uint64_t nodeSize = std::max({ size, alignment, m_minNodeSize });
+		uint32_t order = orderOf(nodeSize);
+		if (order > m_maxOrder) return INVALID_OFFSET;
+
+		// smallest free node which is big enough
+		uint32_t freeOrder = order;
+		while (freeOrder <= m_maxOrder && m_freeLists[freeOrder].empty()) freeOrder++;
+		if (freeOrder > m_maxOrder) return INVALID_OFFSET;
+
+		uint64_t offset = *m_freeLists[freeOrder].begin();
+		m_freeLists[freeOrder].erase(m_freeLists[freeOrder].begin());
+		// split it down, the upper halves go back into the free lists
+		while (freeOrder > order)
+		{
+			freeOrder--;
+			m_freeLists[freeOrder].insert(offset + nodeSizeOf(freeOrder));
+		}
+
+		m_allocations[offset] = order;
+		m_freeBytes -= nodeSizeOf(order);
+		m_requestedBytes += size;
+		m_requestedSizes[offset] = size;
+		return offset;
+	}
+
+	void free(uint64_t offset)
+	{
+		auto it = m_allocations.find(offset);
+		if (it == m_allocations.end())
+		{
+			throw std::invalid_argument("buddy allocator: freeing an offset which was never allocated");
+		}
+		uint32_t order = it->second;
+		m_allocations.erase(it);
+		m_freeBytes += nodeSizeOf(order);
+		m_requestedBytes -= m_requestedSizes[offset];
+		m_requestedSizes.erase(offset);
+
+		// merge with the buddy for as long as the buddy is free too
+		while (order < m_maxOrder)
+		{
+			uint64_t buddy = offset ^ nodeSizeOf(order);
+			auto buddyIt = m_freeLists[order].find(buddy);
+			if (buddyIt == m_freeLists[order].end()) break;
+			m_freeLists[order].erase(buddyIt);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+		m_freeLists[order].insert(offset);
+	}
+
+	bool empty() const { return m_allocations.empty(); }
+	uint64_t blockSize() const { return m_blockSize; }
+	uint64_t freeBytes() const { return m_freeBytes; }
+	uint64_t usedBytes() const { return m_blockSize - m_freeBytes; } // including the rounding up to node sizes
+	uint64_t requestedBytes() const { return m_requestedBytes; } // what the callers actually asked for
+	size_t allocationCount() const { return m_allocations.size(); }
+
+	uint64_t largestFreeNode() const
+	{
+		for (uint32_t order = m_maxOrder + 1; order-- > 0;)
+		{
+			if (!m_freeLists[order].empty()) return nodeSizeOf(order);
+		}
+		return 0;
+	}
+
+private:
+	uint64_t m_blockSize;
+	uint64_t m_minNodeSize;
+	uint32_t m_maxOrder = 0;
+	uint64_t m_freeBytes = 0;
+	uint64_t m_requestedBytes = 0;
+	std::vector<std::set<uint64_t>> m_freeLists; // free node offsets per order, sorted so low addresses are used first
+	std::unordered_map<uint64_t, uint32_t> m_allocations; // offset -> order of every live allocation
+	std::unordered_map<uint64_t, uint64_t> m_requestedSizes; // offset -> requested size of every live allocation
+
+	static bool isPowerOfTwo(uint64_t value) { return value != 0 && (value & (value - 1)) == 0; }
+	uint64_t nodeSizeOf(uint32_t order) const { return m_minNodeSize << order; }
+	uint32_t orderOf(uint64_t size) const
+	{
+		uint32_t order = 0;
+		while (nodeSizeOf(order) < size) order++;
+		return order;
+	}
+};
+
+// a piece of device memory handed out by the DeviceMemoryAllocator
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE; // memory object to bind to
+	VkDeviceSize offset = 0; // offset inside the memory object to bind at
+	VkDeviceSize size = 0;
+	void* mappedData = nullptr; // pointer to the first byte of the allocation if the memory is host visible
+	uint32_t memoryTypeIndex = 0;
+	uint32_t poolIndex = 0;
+	uint32_t blockIndex = 0;
+	bool dedicated = false; // owns its VkDeviceMemory
+};
+
+// what kind of resource is bound to an allocation, needed to respect bufferImageGranularity
+enum class MemoryResourceKind {
+	Linear, // buffers and linearly tiled images
+	Optimal // optimally tiled images
+};
+
+class DeviceMemoryAllocator {
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64ull * 1024 * 1024)
+	{
+		m_device = device;
+		m_blockSize = blockSize;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		m_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+		m_bufferImageGranularity = properties.limits.bufferImageGranularity;
+		// two pools per memory type: linear and optimal resources. They only need to be kept apart when
+		// the device has a granularity, otherwise both kinds share the first pool
+		m_pools.resize(size_t(m_memoryProperties.memoryTypeCount) * 2);
+	}
+
+	// finds a memory type that is allowed by typeFilter and has all the requested properties
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+	{
+		for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	// dedicated = true gives the resource its own VkDeviceMemory (used for large render targets),
+	// anything bigger than half a block gets one as well
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+		MemoryResourceKind kind, bool dedicated)
+	{
+		uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+		if (dedicated || requirements.size > m_blockSize / 2)
+		{
+			return allocateDedicated(requirements.size, memoryTypeIndex);
+		}
+
+		uint32_t poolIndex = memoryTypeIndex * 2 + (kind == MemoryResourceKind::Optimal && m_bufferImageGranularity > 1 ? 1 : 0);
+		std::vector<Block>& pool = m_pools[poolIndex];
+
+		// first block with room
+		for (uint32_t blockIndex = 0; blockIndex < pool.size(); blockIndex++)
+		{
+			uint64_t offset = pool[blockIndex].buddy->allocate(requirements.size, requirements.alignment);
+			if (offset != BuddyAllocator::INVALID_OFFSET)
+			{
+				return makeAllocation(pool[blockIndex], offset, requirements.size, memoryTypeIndex, poolIndex, blockIndex);
+			}
+		}
+
+		// no room anywhere, reserve a new block
+		Block block;
+		block.memory = allocateMemory(m_blockSize, memoryTypeIndex);
+		block.buddy = std::make_unique<BuddyAllocator>(m_blockSize, MIN_NODE_SIZE);
+		if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			// a memory object can only be mapped once, so host visible blocks stay mapped for their whole life
+			vkMapMemory(m_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mappedData);
+		}
+		pool.push_back(std::move(block));
+		uint32_t blockIndex = static_cast<uint32_t>(pool.size() - 1);
+		uint64_t offset = pool[blockIndex].buddy->allocate(requirements.size, requirements.alignment);
+		if (offset == BuddyAllocator::INVALID_OFFSET)
+		{
+			throw std::runtime_error("failed to sub-allocate device memory!");
+		}
+		return makeAllocation(pool[blockIndex], offset, requirements.size, memoryTypeIndex, poolIndex, blockIndex);
+	}
+
+	void free(MemoryAllocation& allocation)
+	{
+		if (allocation.memory == VK_NULL_HANDLE) return;
+		if (allocation.dedicated)
+		{
+			vkFreeMemory(m_device, allocation.memory, nullptr);
+			m_allocationCount--;
+			m_dedicatedCount--;
+			m_dedicatedBytes -= allocation.size;
+		}
+		else
+		{
+			// empty blocks are kept around, the next resource of this kind will most likely need them again
+			m_pools[allocation.poolIndex][allocation.blockIndex].buddy->free(allocation.offset);
+		}
+		allocation = MemoryAllocation{};
+	}
+
+	// frees all the blocks, every allocation must have been freed before
+	void destroy()
+	{
+		for (std::vector<Block>& pool : m_pools)
+		{
+			for (Block& block : pool)
+			{
+				if (!block.buddy->empty())
+				{
+					std::cerr << "memory allocator: block destroyed with " << block.buddy->allocationCount() << " live allocations\n";
+				}
+				vkFreeMemory(m_device, block.memory, nullptr);
+				m_allocationCount--;
+			}
+			pool.clear();
+		}
+	}
+
+	// block usage and fragmentation of every pool
+	void printStats(std::ostream& out) const
+	{
+		out << "memory allocator: " << m_allocationCount << " vkAllocateMemory objects (limit " << m_maxAllocationCount << "), "
+			<< m_dedicatedCount << " dedicated (" << m_dedicatedBytes / 1024 << " KiB), " << m_subAllocationCount << " sub-allocations so far\n";
+		for (size_t poolIndex = 0; poolIndex < m_pools.size(); poolIndex++)
+		{
+			for (size_t blockIndex = 0; blockIndex < m_pools[poolIndex].size(); blockIndex++)
+			{
+				const BuddyAllocator& buddy = *m_pools[poolIndex][blockIndex].buddy;
+				// external fragmentation: how much of the free space is unusable for one big allocation
+				double fragmentation = buddy.freeBytes() == 0 ? 0.0 : 1.0 - double(buddy.largestFreeNode()) / double(buddy.freeBytes());
+				out << "\tmemory type " << poolIndex / 2 << (poolIndex % 2 ? " (optimal)" : " (linear)") << " block " << blockIndex
+					<< ": " << buddy.allocationCount() << " allocations, "
+					<< buddy.requestedBytes() / 1024 << " KiB requested, "
+					<< buddy.usedBytes() / 1024 << " KiB used, "
+					<< buddy.freeBytes() / 1024 << " KiB free of " << buddy.blockSize() / 1024 << " KiB, "
+					<< "largest free " << buddy.largestFreeNode() / 1024 << " KiB, "
+					<< "fragmentation " << static_cast<int>(fragmentation * 100.0) << "%\n";
+			}
+		}
+	}
+
+private:
+	// smallest piece the buddy allocators hand out
+	static constexpr uint64_t MIN_NODE_SIZE = 256;
+
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mappedData = nullptr;
+		std::unique_ptr<BuddyAllocator> buddy;
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+	VkDeviceSize m_blockSize = 0;
+	VkDeviceSize m_bufferImageGranularity = 1;
+	uint32_t m_maxAllocationCount = 0;
+	uint32_t m_allocationCount = 0; // live vkAllocateMemory objects
+	uint32_t m_dedicatedCount = 0;
+	VkDeviceSize m_dedicatedBytes = 0;
+	uint64_t m_subAllocationCount = 0;
+	std::vector<std::vector<Block>> m_pools; // [memoryTypeIndex * 2 + optimal] -> blocks
+
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex)
+	{
+		if (m_allocationCount >= m_maxAllocationCount)
+		{
+			throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+		}
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate device memory!");
+		}
+		m_allocationCount++;
+		return memory;
+	}
+
+	MemoryAllocation allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex)
+	{
+		MemoryAllocation allocation;
+		allocation.memory = allocateMemory(size, memoryTypeIndex);
+		allocation.size = size;
+		allocation.memoryTypeIndex = memoryTypeIndex;
+		allocation.dedicated = true;
+		if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			vkMapMemory(m_device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mappedData);
+		}
+		m_dedicatedCount++;
+		m_dedicatedBytes += size;
+		return allocation;
+	}
+
+	MemoryAllocation makeAllocation(const Block& block, uint64_t offset, VkDeviceSize size, uint32_t memoryTypeIndex, uint32_t poolIndex, uint32_t blockIndex)
+	{
+		MemoryAllocation allocation;
+		allocation.memory = block.memory;
+		allocation.offset = offset;
+		allocation.size = size;
+		allocation.mappedData = block.mappedData ? static_cast<char*>(block.mappedData) + offset : nullptr;
+		allocation.memoryTypeIndex = memoryTypeIndex;
+		allocation.poolIndex = poolIndex;
+		allocation.blockIndex = blockIndex;
+		m_subAllocationCount++;
+		return allocation;
+	}
+};
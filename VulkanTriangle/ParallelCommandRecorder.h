@@ -0,0 +1,136 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include "JobSystem.h"
+
+// records the draws of a render pass on the threads of a JobSystem
+// the draw list is cut into contiguous ranges, every range is recorded by a job into a secondary command buffer of its own,
+// the primary command buffer executes them in draw order:
+//
+//   vkCmdBeginRenderPass(primary, ..., VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+//   const std::vector<VkCommandBuffer>& secondaries = recorder.record(frame, inheritanceInfo, drawCount, recordRange);
+//   vkCmdExecuteCommands(primary, secondaries.size(), secondaries.data());
+//
+// inheritanceInfo names the render pass and framebuffer, or (dynamic rendering) chains a VkCommandBufferInheritanceRenderingInfo
+//
+// command pools are not thread safe, so every (frame in flight, range) pair has a pool of its own,
+// the pools of a frame are reset as a whole when the frame is recorded again
+
+class ParallelCommandRecorder {
+public:
+	// records draws [firstDraw, firstDraw + drawCount) into commandBuffer, which is already begun (state has to be bound again,
+	// secondary command buffers do not inherit it)
+	using RecordRange = std::function<void(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount)>;
+
+	// the draw list is cut into at most rangeCount ranges, usually the thread count of jobs
+	void init(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, JobSystem& jobs, uint32_t rangeCount)
+	{
+		m_device = device;
+		m_jobs = &jobs;
+		m_rangeCount = std::max(rangeCount, 1u);
+		m_frames.resize(frameCount);
+		for (Frame& frame : m_frames)
+		{
+			frame.slots.resize(m_rangeCount);
+			for (RangeSlot& slot : frame.slots)
+			{
+				VkCommandPoolCreateInfo poolInfo{};
+				poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+				poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // reset as a whole every time the frame is recorded
+				poolInfo.queueFamilyIndex = queueFamilyIndex;
+				if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &slot.pool) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create recording command pool!");
+				}
+				VkCommandBufferAllocateInfo allocInfo{};
+				allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				allocInfo.commandPool = slot.pool;
+				allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+				allocInfo.commandBufferCount = 1;
+				if (vkAllocateCommandBuffers(m_device, &allocInfo, &slot.commandBuffer) != VK_SUCCESS) {
+					throw std::runtime_error("failed to allocate secondary command buffer!");
+				}
+			}
+		}
+	}
+
+	// the GPU must be done with every frame recorded so far
+	void destroy()
+	{
+		for (Frame& frame : m_frames)
+		{
+			for (RangeSlot& slot : frame.slots)
+			{
+				vkDestroyCommandPool(m_device, slot.pool, nullptr);
+			}
+		}
+		m_frames.clear();
+	}
+
+	// records drawCount draws into secondary command buffers of frame, the GPU must be done with the last recording of frame
+	// the result stays valid until frame is recorded again
+	const std::vector<VkCommandBuffer>& record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritanceInfo,
+		uint32_t drawCount, const RecordRange& recordRange)
+	{
+		Frame& current = m_frames[frame];
+		for (RangeSlot& slot : current.slots)
+		{
+			vkResetCommandPool(m_device, slot.pool, 0);
+		}
+
+		// contiguous ranges keep the draw order when the secondaries are executed one after the other
+		uint32_t usedRanges = std::max(std::min(m_rangeCount, drawCount), 1u);
+		uint32_t drawsPerRange = (drawCount + usedRanges - 1) / usedRanges;
+
+		auto recordSlot = [&](uint32_t range) {
+			VkCommandBuffer commandBuffer = current.slots[range].commandBuffer;
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			// everything is recorded inside the render pass (or rendering) the primary command buffer began
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+			if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+				throw std::runtime_error("failed to begin recording secondary command buffer!");
+			}
+			uint32_t firstDraw = std::min(range * drawsPerRange, drawCount);
+			uint32_t lastDraw = std::min(firstDraw + drawsPerRange, drawCount);
+			recordRange(commandBuffer, firstDraw, lastDraw - firstDraw);
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to record secondary command buffer!");
+			}
+		};
+		m_jobs->parallelFor(usedRanges, 1, [&](uint32_t first, uint32_t count) {
+			for (uint32_t range = first; range < first + count; range++)
+			{
+				recordSlot(range);
+			}
+		});
+
+		m_result.clear();
+		for (uint32_t range = 0; range < usedRanges; range++)
+		{
+			m_result.push_back(current.slots[range].commandBuffer);
+		}
+		return m_result;
+	}
+
+	uint32_t rangeCount() const { return m_rangeCount; }
+
+private:
+	struct RangeSlot {
+		VkCommandPool pool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	};
+	struct Frame {
+		std::vector<RangeSlot> slots; // one per range
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	JobSystem* m_jobs = nullptr;
+	uint32_t m_rangeCount = 1;
+	std::vector<Frame> m_frames;
+	std::vector<VkCommandBuffer> m_result;
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+// VkPipelineCache which survives restarts: loaded from a file at startup, written back at shutdown
+// (and whenever save() is called), so the driver only compiles a pipeline from scratch the first time it sees it
+//
+// the file is only used if its header matches this driver and device, anything else starts with an empty cache:
+// a cache from another GPU or driver version is useless at best
+//
+// with VK_EXT_pipeline_creation_feedback every pipeline created through creationFeedback() reports whether
+// it came out of the cache
+
+struct PipelineCacheStats {
+	size_t loadedBytes = 0; // size of the file used at startup (0 if cold)
+	size_t savedBytes = 0; // size of the last file written
+	uint32_t saves = 0; // files written
+	uint32_t pipelinesCreated = 0; // pipelines reported through recordCreation()
+	uint32_t hits = 0; // pipelines the driver found in the cache
+	uint32_t misses = 0; // pipelines the driver had to compile
+	double creationMilliseconds = 0.0; // time spent creating the reported pipelines
+	std::string rejectReason; // why the file was not used, empty if it was (or there was none)
+};
+
+class PersistentPipelineCache {
+public:
+	// true if the device can tell cache hits from misses
+	static bool supportsCreationFeedback(VkPhysicalDevice physicalDevice)
+	{
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+		for (const VkExtensionProperties& extension : extensions)
+		{
+			if (strcmp(extension.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// feedbackEnabled: the device was created with VK_EXT_pipeline_creation_feedback
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path, bool feedbackEnabled)
+	{
+		m_device = device;
+		m_path = path;
+		m_feedbackEnabled = feedbackEnabled;
+		vkGetPhysicalDeviceProperties(physicalDevice, &m_properties);
+
+		std::vector<char> initialData = load();
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = initialData.size();
+		cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+		if (vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_cache) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+		m_stats.loadedBytes = initialData.size();
+		m_savedData = std::move(initialData);
+	}
+
+	// saves the cache one last time
+	void destroy()
+	{
+		save();
+		vkDestroyPipelineCache(m_device, m_cache, nullptr);
+		m_cache = VK_NULL_HANDLE;
+	}
+
+	VkPipelineCache handle() const { return m_cache; }
+
+	// writes the cache to disk if the driver added something since the last save (one thread at a time)
+	// the file is written next to the old one and renamed over it, so a crash never leaves half a cache behind
+	bool save()
+	{
+		size_t size = 0;
+		if (vkGetPipelineCacheData(m_device, m_cache, &size, nullptr) != VK_SUCCESS) {
+			return false;
+		}
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(m_device, m_cache, &size, data.data()) != VK_SUCCESS) {
+			return false;
+		}
+		data.resize(size);
+		if (data == m_savedData) {
+			return true;
+		}
+
+		std::string temporaryPath = m_path + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!file.write(data.data(), data.size())) {
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, m_path, error);
+		if (error) {
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.savedBytes = data.size();
+			m_stats.saves++;
+		}
+		m_savedData = std::move(data);
+		return true;
+	}
+
+	// filled in by the driver while a pipeline is created
+	struct CreationFeedback {
+		VkPipelineCreationFeedbackCreateInfoEXT info{};
+		VkPipelineCreationFeedbackEXT pipeline{};
+		std::vector<VkPipelineCreationFeedbackEXT> stages;
+	};
+	// returns nullptr if the device cannot report cache hits, otherwise chain the result's info into the create info
+	CreationFeedback* creationFeedback(CreationFeedback& feedback, uint32_t stageCount) const
+	{
+		if (!m_feedbackEnabled) {
+			return nullptr;
+		}
+		feedback.stages.assign(stageCount, VkPipelineCreationFeedbackEXT{});
+		feedback.info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+		feedback.info.pPipelineCreationFeedback = &feedback.pipeline;
+		feedback.info.pipelineStageCreationFeedbackCount = stageCount;
+		feedback.info.pPipelineStageCreationFeedbacks = feedback.stages.data();
+		return &feedback;
+	}
+
+	// counts a pipeline created with the cache, feedback is nullptr if there was none
+	void recordCreation(const CreationFeedback* feedback, double milliseconds)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.pipelinesCreated++;
+		m_stats.creationMilliseconds += milliseconds;
+		if (feedback != nullptr && (feedback->pipeline.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+			if (feedback->pipeline.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+				m_stats.hits++;
+			}
+			else {
+				m_stats.misses++;
+			}
+		}
+	}
+
+	PipelineCacheStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		PipelineCacheStats current = stats();
+		out << "pipeline cache (" << (current.loadedBytes > 0 ? "warm, " + std::to_string(current.loadedBytes) + " bytes loaded" : "cold") << "): "
+			<< current.pipelinesCreated << " pipelines in " << current.creationMilliseconds << " ms";
+		if (m_feedbackEnabled) {
+			out << ", " << current.hits << " hits, " << current.misses << " misses";
+		}
+		out << ", " << current.saves << " saves (" << current.savedBytes << " bytes)";
+		if (!current.rejectReason.empty()) {
+			out << ", " << m_path << " not used: " << current.rejectReason;
+		}
+		out << "\n";
+	}
+
+private:
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPipelineCache m_cache = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties m_properties{};
+	std::string m_path;
+	bool m_feedbackEnabled = false;
+	std::vector<char> m_savedData; // what the file holds right now
+	mutable std::mutex m_mutex; // guards m_stats, pipelines can be created on several threads
+	PipelineCacheStats m_stats;
+
+	// contents of the file if it was written by this driver for this device, empty otherwise
+	std::vector<char> load()
+	{
+		std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+		if (!file.is_open()) {
+			return {};
+		}
+		std::vector<char> data(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(data.data(), data.size());
+
+		VkPipelineCacheHeaderVersionOne header{};
+		if (!file || data.size() < sizeof(header)) {
+			m_stats.rejectReason = "truncated";
+			return {};
+		}
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+			m_stats.rejectReason = "unknown header";
+		}
+		else if (header.vendorID != m_properties.vendorID || header.deviceID != m_properties.deviceID) {
+			m_stats.rejectReason = "written for another GPU";
+		}
+		else if (memcmp(header.pipelineCacheUUID, m_properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			m_stats.rejectReason = "written by another driver version";
+		}
+		return m_stats.rejectReason.empty() ? data : std::vector<char>{};
+	}
+};
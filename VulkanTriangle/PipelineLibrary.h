@@ -0,0 +1,379 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include "PipelineRegistry.h"
+
+// VK_EXT_graphics_pipeline_library: a pipeline is put together from four parts which are compiled on their own,
+//   vertex input       vertex bindings and attributes, topology
+//   pre-rasterization  vertex shader, rasterization state
+//   fragment shader    fragment shader, depth state
+//   fragment output    blending, sample count, attachment formats
+// every part is shared by all variants which agree on what it contains, so a new variant usually only needs the part
+// that changed (or none) and a link:
+//
+//   VkPipeline fast = library.link(desc, false);      // fraction of a full compile, ready for the next frame
+//   VkPipeline optimized = library.link(desc, true);  // link time optimization, about as slow as a full compile
+//
+// the build function creates one part of desc (the state which does not belong to the part is ignored by the driver)
+//
+// the shader parts are keyed by the shader revision, once the pipelines of an old revision have been replaced its parts
+// are retired and handed back as soon as no link uses them anymore:
+//
+//   library.retireShaderRevisions(revision);   // every revision older than revision
+//   for (VkPipeline part : library.takeRetired()) ...destroy part...
+
+struct PipelineLibraryStats {
+	uint32_t parts = 0; // library parts compiled
+	uint64_t partHits = 0; // parts a link found already compiled
+	uint32_t retiredParts = 0; // shader parts of old revisions handed to takeRetired()
+	double partMilliseconds = 0.0;
+	uint32_t fastLinks = 0;
+	double fastLinkMilliseconds = 0.0;
+	uint32_t optimizedLinks = 0;
+	double optimizedLinkMilliseconds = 0.0;
+};
+
+class GraphicsPipelineLibrary {
+public:
+	// compiles the part of desc given by flags (one VK_GRAPHICS_PIPELINE_LIBRARY_*_BIT_EXT) as a pipeline library
+	using BuildPart = std::function<VkPipeline(const GraphicsPipelineDesc& desc, VkGraphicsPipelineLibraryFlagsEXT part)>;
+
+	// true if the device has VK_EXT_graphics_pipeline_library with the graphicsPipelineLibrary feature
+	static bool querySupport(VkInstance instance, uint32_t instanceApiVersion, VkPhysicalDevice physicalDevice)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (instanceApiVersion < VK_API_VERSION_1_1 || properties.apiVersion < VK_API_VERSION_1_1)
+		{
+			return false;
+		}
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+		bool hasLibrary = false, hasPipelineLibrary = false;
+		for (const VkExtensionProperties& extension : extensions)
+		{
+			hasLibrary |= strcmp(extension.extensionName, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) == 0;
+			hasPipelineLibrary |= strcmp(extension.extensionName, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) == 0;
+		}
+		auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2"));
+		if (!hasLibrary || !hasPipelineLibrary || getFeatures2 == nullptr)
+		{
+			return false;
+		}
+		VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+		libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+		VkPhysicalDeviceFeatures2 features{};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &libraryFeatures;
+		getFeatures2(physicalDevice, &features);
+		return libraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+	}
+
+	// turns the extensions and the feature on, createInfo has to be used before this object goes away
+	void enable(VkDeviceCreateInfo& createInfo, std::vector<const char*>& extensions)
+	{
+		extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+		extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+		m_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+		m_features.graphicsPipelineLibrary = VK_TRUE;
+		m_features.pNext = const_cast<void*>(createInfo.pNext);
+		createInfo.pNext = &m_features;
+	}
+
+	void init(VkDevice device, VkPipelineCache cache, BuildPart buildPart)
+	{
+		m_device = device;
+		m_cache = cache;
+		m_buildPart = std::move(buildPart);
+	}
+
+	// the linked pipelines do not need their parts, they can go in any order
+	void destroy()
+	{
+		for (auto& parts : m_parts)
+		{
+			for (auto& [key, part] : parts)
+			{
+				if (part->pipeline != VK_NULL_HANDLE)
+				{
+					vkDestroyPipeline(m_device, part->pipeline, nullptr);
+				}
+			}
+			parts.clear();
+		}
+		for (std::unique_ptr<Part>& part : m_retiring)
+		{
+			if (part->pipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(m_device, part->pipeline, nullptr);
+			}
+		}
+		m_retiring.clear();
+		for (VkPipeline pipeline : m_retired)
+		{
+			vkDestroyPipeline(m_device, pipeline, nullptr);
+		}
+		m_retired.clear();
+	}
+
+	// desc's pipeline out of its four parts (compiled first if no earlier variant needed them), safe from several threads
+	// optimized asks the driver for link time optimization, which takes about as long as a full compile
+	// throws if desc's shader revision has been retired
+	VkPipeline link(const GraphicsPipelineDesc& desc, bool optimized)
+	{
+		// a part is not retired while a link holds it
+		Part* held[PartCount] = {};
+		auto release = [&]() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (Part* part : held)
+			{
+				if (part) part->links--;
+			}
+			collectRetired();
+		};
+		VkPipeline libraries[PartCount];
+		try {
+			for (uint32_t part = 0; part < PartCount; part++)
+			{
+				libraries[part] = partPipeline(desc, part, held[part]);
+			}
+		}
+		catch (...) {
+			release();
+			throw;
+		}
+
+		VkPipelineLibraryCreateInfoKHR libraryInfo{};
+		libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+		libraryInfo.libraryCount = PartCount;
+		libraryInfo.pLibraries = libraries;
+		VkGraphicsPipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.pNext = &libraryInfo;
+		pipelineInfo.flags = optimized ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+		pipelineInfo.layout = desc.layout;
+		pipelineInfo.basePipelineIndex = -1;
+
+		auto linkBegin = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline;
+		VkResult result = vkCreateGraphicsPipelines(m_device, m_cache, 1, &pipelineInfo, nullptr, &pipeline);
+		release();
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to link graphics pipeline!");
+		}
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - linkBegin).count();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (optimized) {
+			m_stats.optimizedLinks++;
+			m_stats.optimizedLinkMilliseconds += milliseconds;
+		}
+		else {
+			m_stats.fastLinks++;
+			m_stats.fastLinkMilliseconds += milliseconds;
+		}
+		return pipeline;
+	}
+
+	// the pipelines of every shader revision older than firstLiveRevision have been replaced, their shader parts are not
+	// linked again (link() throws for them) and go to takeRetired() once the links which are still running are done
+	void retireShaderRevisions(uint64_t firstLiveRevision)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_firstLiveRevision = std::max(m_firstLiveRevision, firstLiveRevision);
+		for (uint32_t part = 0; part < PartCount; part++)
+		{
+			if (!isShaderPart(part)) continue;
+			for (auto it = m_parts[part].begin(); it != m_parts[part].end();)
+			{
+				if (it->first.shaderRevision < m_firstLiveRevision)
+				{
+					m_retiring.push_back(std::move(it->second));
+					it = m_parts[part].erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+		collectRetired();
+	}
+
+	// the parts retired since the last call, no link uses them anymore (the linked pipelines do not need them either)
+	std::vector<VkPipeline> takeRetired()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<VkPipeline> retired;
+		retired.swap(m_retired);
+		return retired;
+	}
+
+	PipelineLibraryStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		PipelineLibraryStats current = stats();
+		auto average = [](double milliseconds, uint32_t count) { return count > 0 ? milliseconds / count : 0.0; };
+		out << "pipeline library: " << current.parts << " parts compiled in " << current.partMilliseconds << " ms (" << current.partHits
+			<< " reused), fast link " << average(current.fastLinkMilliseconds, current.fastLinks) << " ms x" << current.fastLinks
+			<< ", optimized link " << average(current.optimizedLinkMilliseconds, current.optimizedLinks) << " ms x" << current.optimizedLinks
+			<< ", " << current.retiredParts << " parts of old shader revisions retired\n";
+	}
+
+private:
+	static constexpr uint32_t PartCount = 4;
+	static constexpr VkGraphicsPipelineLibraryFlagsEXT PartFlags[PartCount] = {
+		VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+	};
+
+	struct Part {
+		std::once_flag built; // the first thread to need the part compiles it, the others wait for it
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		uint32_t links = 0; // links which hold the part right now, guarded by m_mutex
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPipelineCache m_cache = VK_NULL_HANDLE;
+	BuildPart m_buildPart;
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT m_features{};
+	mutable std::mutex m_mutex; // guards m_parts, the retired parts and m_stats
+	std::unordered_map<GraphicsPipelineDesc, std::unique_ptr<Part>, GraphicsPipelineDescHash> m_parts[PartCount]; // keyed by partKey()
+	uint64_t m_firstLiveRevision = 0; // shader parts of older revisions are retired
+	std::vector<std::unique_ptr<Part>> m_retiring; // retired, but still held by a link
+	std::vector<VkPipeline> m_retired; // waiting for takeRetired()
+	PipelineLibraryStats m_stats;
+
+	// the parts which contain shaders, only these depend on the shader revision
+	static bool isShaderPart(uint32_t part)
+	{
+		return PartFlags[part] == VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT ||
+			PartFlags[part] == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+	}
+
+	// moves the retiring parts no link holds anymore to m_retired, m_mutex must be locked
+	void collectRetired()
+	{
+		for (auto it = m_retiring.begin(); it != m_retiring.end();)
+		{
+			if ((*it)->links > 0)
+			{
+				++it;
+				continue;
+			}
+			if ((*it)->pipeline != VK_NULL_HANDLE)
+			{
+				m_retired.push_back((*it)->pipeline);
+				m_stats.retiredParts++;
+			}
+			it = m_retiring.erase(it);
+		}
+	}
+
+	// desc with everything which does not go into the part left at its default, variants with equal keys share the part
+	static GraphicsPipelineDesc partKey(const GraphicsPipelineDesc& desc, uint32_t part)
+	{
+		GraphicsPipelineDesc key;
+		auto keepRenderTarget = [&]() {
+			key.renderPass = desc.renderPass;
+			key.subpass = desc.subpass;
+			key.colorFormat = desc.colorFormat;
+			key.depthFormat = desc.depthFormat;
+		};
+		// the build function checks the pair of shaders against the layout, so both shader parts keep both of them
+		// (specialization constants of the other stage do not matter)
+		auto keepShaders = [&](VkShaderStageFlagBits stage) {
+			key.vertexShader = desc.vertexShader;
+			key.fragmentShader = desc.fragmentShader;
+			key.shaderRevision = desc.shaderRevision;
+			for (const SpecializationConstant& constant : desc.specialization)
+			{
+				if (constant.stage == stage) key.specialization.push_back(constant);
+			}
+		};
+		switch (PartFlags[part])
+		{
+		case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+			key.vertexBindings = desc.vertexBindings;
+			key.vertexAttributes = desc.vertexAttributes;
+			key.topology = desc.topology;
+			break;
+		case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+			keepShaders(VK_SHADER_STAGE_VERTEX_BIT);
+			key.polygonMode = desc.polygonMode;
+			key.cullMode = desc.cullMode;
+			key.frontFace = desc.frontFace;
+			key.layout = desc.layout;
+			keepRenderTarget();
+			break;
+		case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+			keepShaders(VK_SHADER_STAGE_FRAGMENT_BIT);
+			key.depthTest = desc.depthTest;
+			key.depthWrite = desc.depthWrite;
+			key.samples = desc.samples;
+			key.layout = desc.layout;
+			keepRenderTarget();
+			break;
+		default:
+			key.alphaBlend = desc.alphaBlend;
+			key.samples = desc.samples;
+			keepRenderTarget();
+			break;
+		}
+		return key;
+	}
+
+	// held is set to the part before it is built, link() lets go of it
+	VkPipeline partPipeline(const GraphicsPipelineDesc& desc, uint32_t part, Part*& held)
+	{
+		GraphicsPipelineDesc key = partKey(desc, part);
+		Part* entry;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (isShaderPart(part) && key.shaderRevision < m_firstLiveRevision)
+			{
+				throw std::runtime_error("graphics pipeline library: shader revision has been retired!");
+			}
+			std::unique_ptr<Part>& slot = m_parts[part][key];
+			if (slot)
+			{
+				m_stats.partHits++;
+			}
+			else
+			{
+				slot = std::make_unique<Part>();
+			}
+			entry = slot.get();
+			entry->links++;
+			held = entry;
+		}
+		// a build which throws leaves the part unbuilt, the next link tries again
+		std::call_once(entry->built, [&]() {
+			auto partBegin = std::chrono::high_resolution_clock::now();
+			entry->pipeline = m_buildPart(key, PartFlags[part]);
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - partBegin).count();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.parts++;
+			m_stats.partMilliseconds += milliseconds;
+		});
+		return entry->pipeline;
+	}
+};
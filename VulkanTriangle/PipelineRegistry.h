@@ -0,0 +1,389 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+#include "JobSystem.h"
+
+// value of one specialization constant of one stage, 32 bits (bools are 0 or 1)
+struct SpecializationConstant {
+	VkShaderStageFlagBits stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	uint32_t constantId = 0;
+	uint32_t value = 0;
+};
+
+// everything a graphics pipeline is built from, two equal descriptions always give the same pipeline
+// (viewport and scissor are dynamic, so the swap chain size is not part of it)
+struct GraphicsPipelineDesc {
+	std::string vertexShader; // SPIR-V file
+	std::string fragmentShader; // SPIR-V file
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	bool depthTest = true;
+	bool depthWrite = true;
+	bool alphaBlend = false; // src alpha over dst, opaque otherwise
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE; // VK_NULL_HANDLE: dynamic rendering to the formats below
+	uint32_t subpass = 0;
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED; // attachments for dynamic rendering
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	uint64_t shaderRevision = 0; // which compile of the shader sources, 0 = the SPIR-V files (see ShaderHotReload.h)
+	std::vector<SpecializationConstant> specialization; // constants left out keep the shader's default
+
+	bool operator==(const GraphicsPipelineDesc& other) const
+	{
+		auto sameBinding = [](const VkVertexInputBindingDescription& a, const VkVertexInputBindingDescription& b) {
+			return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+		};
+		auto sameAttribute = [](const VkVertexInputAttributeDescription& a, const VkVertexInputAttributeDescription& b) {
+			return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+		};
+		auto sameConstant = [](const SpecializationConstant& a, const SpecializationConstant& b) {
+			return a.stage == b.stage && a.constantId == b.constantId && a.value == b.value;
+		};
+		return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+			std::equal(vertexBindings.begin(), vertexBindings.end(), other.vertexBindings.begin(), other.vertexBindings.end(), sameBinding) &&
+			std::equal(vertexAttributes.begin(), vertexAttributes.end(), other.vertexAttributes.begin(), other.vertexAttributes.end(), sameAttribute) &&
+			topology == other.topology && polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace &&
+			samples == other.samples && depthTest == other.depthTest && depthWrite == other.depthWrite && alphaBlend == other.alphaBlend &&
+			layout == other.layout && renderPass == other.renderPass && subpass == other.subpass &&
+			colorFormat == other.colorFormat && depthFormat == other.depthFormat &&
+			shaderRevision == other.shaderRevision &&
+			std::equal(specialization.begin(), specialization.end(), other.specialization.begin(), other.specialization.end(), sameConstant);
+	}
+
+	size_t hash() const
+	{
+		size_t seed = 0;
+		auto combine = [&seed](size_t value) { seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2); };
+		combine(std::hash<std::string>()(vertexShader));
+		combine(std::hash<std::string>()(fragmentShader));
+		for (const VkVertexInputBindingDescription& binding : vertexBindings)
+		{
+			combine(binding.binding);
+			combine(binding.stride);
+			combine(binding.inputRate);
+		}
+		for (const VkVertexInputAttributeDescription& attribute : vertexAttributes)
+		{
+			combine(attribute.location);
+			combine(attribute.binding);
+			combine(attribute.format);
+			combine(attribute.offset);
+		}
+		combine(topology);
+		combine(polygonMode);
+		combine(cullMode);
+		combine(frontFace);
+		combine(samples);
+		combine((depthTest ? 1 : 0) | (depthWrite ? 2 : 0) | (alphaBlend ? 4 : 0));
+		combine(std::hash<uint64_t>()(reinterpret_cast<uint64_t>(layout)));
+		combine(std::hash<uint64_t>()(reinterpret_cast<uint64_t>(renderPass)));
+		combine(subpass);
+		combine(colorFormat);
+		combine(depthFormat);
+		combine(std::hash<uint64_t>()(shaderRevision));
+		for (const SpecializationConstant& constant : specialization)
+		{
+			combine(constant.stage);
+			combine(constant.constantId);
+			combine(constant.value);
+		}
+		return seed;
+	}
+};
+
+struct GraphicsPipelineDescHash {
+	size_t operator()(const GraphicsPipelineDesc& desc) const { return desc.hash(); }
+};
+
+struct PipelineRegistryStats {
+	uint32_t variants = 0; // descriptions requested so far
+	uint32_t ready = 0; // of which have been compiled
+	uint32_t queueDepth = 0; // compiles which have not finished yet
+	uint32_t peakQueueDepth = 0;
+	uint64_t hitchesAvoided = 0; // variants compiled in the background instead of on the spot (failed compiles not included)
+	double compileMilliseconds = 0.0; // time spent in the build function, summed over all threads
+	uint32_t optimized = 0; // variants whose first pipeline has been replaced by an optimized one
+	double optimizeMilliseconds = 0.0; // time spent in the optimize function
+};
+
+// graphics pipelines keyed by their description, compiled as jobs in the background
+//
+//   VkPipeline pipeline = registry.request(desc);   // starts compiling desc the first time it is seen
+//   if (pipeline == VK_NULL_HANDLE) pipeline = fallback;   // not compiled yet, draw with something else (or skip)
+//
+// the build function turns a description into a pipeline, it runs on job threads and has to be thread safe
+// (vkCreateGraphicsPipelines is)
+//
+// with enableOptimization() the build function only has to be quick (a pipeline library link), every variant is then
+// built a second time with the optimize function in the background and the result replaces the quick pipeline:
+//
+//   for (VkPipeline old : registry.takeReplaced()) ...destroy old once the frames which used it are done...
+
+class PipelineRegistry {
+public:
+	using BuildPipeline = std::function<VkPipeline(const GraphicsPipelineDesc& desc)>;
+
+	void init(VkDevice device, JobSystem& jobs, BuildPipeline build)
+	{
+		m_device = device;
+		m_jobs = &jobs;
+		m_build = std::move(build);
+	}
+
+	// builds every variant again with optimize after the build function returned, request() hands out the new pipeline
+	// as soon as it is done (call before the first request)
+	void enableOptimization(BuildPipeline optimize)
+	{
+		m_optimize = std::move(optimize);
+	}
+
+	// waits for the compiles which are still running, the GPU must be done with every pipeline
+	void destroy()
+	{
+		// first compiles queue the optimizations, so they are waited for first
+		for (auto& [desc, entry] : m_entries)
+		{
+			m_jobs->wait(entry->compiling);
+		}
+		m_jobs->wait(m_optimizing);
+		for (auto& [desc, entry] : m_entries)
+		{
+			VkPipeline pipeline = entry->pipeline.load();
+			if (pipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(m_device, pipeline, nullptr);
+			}
+		}
+		m_entries.clear();
+		for (VkPipeline pipeline : m_replaced)
+		{
+			vkDestroyPipeline(m_device, pipeline, nullptr);
+		}
+		m_replaced.clear();
+	}
+
+	// the pipeline for desc or VK_NULL_HANDLE while it is being compiled (the first request starts the compile)
+	// without worker threads there is nobody to compile in the background, the first request compiles right away
+	// a variant whose compile failed stays VK_NULL_HANDLE (the error is printed once)
+	VkPipeline request(const GraphicsPipelineDesc& desc)
+	{
+		bool created = false;
+		std::shared_ptr<Entry> entry = find(desc, created);
+		VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			return pipeline;
+		}
+		if (created && m_jobs->threadCount() < 2)
+		{
+			compileLogged(desc, *entry);
+			return entry->pipeline.load(std::memory_order_acquire);
+		}
+		if (created)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stats.queueDepth++;
+				m_stats.peakQueueDepth = std::max(m_stats.peakQueueDepth, m_stats.queueDepth);
+			}
+			// remove() may forget the entry as soon as it is published, the job keeps it alive for its counter
+			// but does not look at it again
+			m_jobs->run([this, desc, entry]() {
+				bool compiled = compileLogged(desc, *entry);
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stats.queueDepth--;
+				// once per variant, however many frames asked for it while it was pending
+				if (compiled) m_stats.hitchesAvoided++;
+			}, &entry->compiling);
+		}
+		return VK_NULL_HANDLE;
+	}
+
+	// the pipeline for desc, compiled on the calling thread if nobody has started it yet
+	// (for pipelines which are needed before the first frame), throws if it cannot be compiled
+	VkPipeline compileNow(const GraphicsPipelineDesc& desc)
+	{
+		bool created = false;
+		std::shared_ptr<Entry> entry = find(desc, created);
+		if (created)
+		{
+			try {
+				compile(desc, *entry);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				entry->failed = true;
+				throw;
+			}
+		}
+		// queued by an earlier request, wait for that compile alone (not for the other variants or the optimizations)
+		while (entry->pipeline.load(std::memory_order_acquire) == VK_NULL_HANDLE)
+		{
+			if (entry->failed)
+			{
+				throw std::runtime_error("failed to compile graphics pipeline variant!");
+			}
+			m_jobs->wait(entry->compiling);
+		}
+		return entry->pipeline.load(std::memory_order_acquire);
+	}
+
+	// forgets desc and hands its pipeline to the caller, who destroys it once the GPU is done with it (VK_NULL_HANDLE if there is none)
+	// a variant which is still being compiled (or optimized) stays where it is, destroy() takes care of it
+	VkPipeline remove(const GraphicsPipelineDesc& desc)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(desc);
+		if (it == m_entries.end())
+		{
+			return VK_NULL_HANDLE;
+		}
+		VkPipeline pipeline = it->second->pipeline.load(std::memory_order_acquire);
+		if ((pipeline == VK_NULL_HANDLE && !it->second->failed) || it->second->optimizing)
+		{
+			return VK_NULL_HANDLE;
+		}
+		m_entries.erase(it);
+		m_stats.variants--;
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			m_stats.ready--;
+		}
+		return pipeline;
+	}
+
+	// the quick pipelines optimized ones have replaced since the last call, frames recorded earlier may still use them
+	std::vector<VkPipeline> takeReplaced()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<VkPipeline> replaced;
+		replaced.swap(m_replaced);
+		return replaced;
+	}
+
+	PipelineRegistryStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		PipelineRegistryStats current = stats();
+		out << "pipeline registry: " << current.ready << "/" << current.variants << " variants compiled in "
+			<< current.compileMilliseconds << " ms, compile queue " << current.queueDepth << " (peak " << current.peakQueueDepth << "), "
+			<< current.hitchesAvoided << " compile hitches avoided\n";
+		if (m_optimize)
+		{
+			out << "pipeline registry: " << current.optimized << " variants optimized in " << current.optimizeMilliseconds << " ms\n";
+		}
+	}
+
+private:
+	// pipeline and failed are published under m_mutex, remove() may forget the entry from then on
+	struct Entry {
+		std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE }; // set once the compile has finished
+		std::atomic<bool> failed{ false };
+		bool optimizing = false; // the optimized pipeline is being built, guarded by m_mutex
+		JobCounter compiling; // the background compile of the first pipeline
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	JobSystem* m_jobs = nullptr;
+	BuildPipeline m_build;
+	BuildPipeline m_optimize; // empty: the first pipeline stays
+	mutable std::mutex m_mutex; // guards m_entries, m_replaced and m_stats
+	std::unordered_map<GraphicsPipelineDesc, std::shared_ptr<Entry>, GraphicsPipelineDescHash> m_entries;
+	JobCounter m_optimizing; // optimizations which have not finished yet
+	std::vector<VkPipeline> m_replaced; // waiting for takeReplaced()
+	PipelineRegistryStats m_stats;
+
+	std::shared_ptr<Entry> find(const GraphicsPipelineDesc& desc, bool& created)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::shared_ptr<Entry>& slot = m_entries[desc];
+		created = !slot;
+		if (created)
+		{
+			slot = std::make_shared<Entry>();
+			m_stats.variants++;
+		}
+		return slot;
+	}
+
+	// background compiles have nobody to throw to, false if the compile failed
+	// entry must not be touched once this returns (see Entry)
+	bool compileLogged(const GraphicsPipelineDesc& desc, Entry& entry)
+	{
+		try {
+			compile(desc, entry);
+			return true;
+		}
+		catch (const std::exception& e) {
+			std::cerr << "pipeline registry: " << desc.vertexShader << " + " << desc.fragmentShader << ": " << e.what() << std::endl;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			entry.failed = true;
+			return false;
+		}
+	}
+
+	// without worker threads the optimized pipeline would wait for somebody to help the job system, it is built right away instead
+	void compile(const GraphicsPipelineDesc& desc, Entry& entry)
+	{
+		bool optimizeLater = m_optimize && m_jobs->threadCount() >= 2;
+		auto compileBegin = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline = (m_optimize && !optimizeLater) ? m_optimize(desc) : m_build(desc);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileBegin).count();
+		// published together with optimizing, so remove() never forgets an entry the optimization is about to use
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry.pipeline.store(pipeline, std::memory_order_release);
+		m_stats.ready++;
+		m_stats.compileMilliseconds += milliseconds;
+		if (!optimizeLater)
+		{
+			return;
+		}
+		entry.optimizing = true;
+		// destroy() waits for m_optimizing before the entries go away, remove() leaves an optimizing entry alone
+		Entry* optimizing = &entry;
+		m_jobs->run([this, desc, optimizing]() { optimize(desc, *optimizing); }, &m_optimizing);
+	}
+
+	// keeps the quick pipeline if the optimized one cannot be built
+	void optimize(const GraphicsPipelineDesc& desc, Entry& entry)
+	{
+		auto optimizeBegin = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		try {
+			pipeline = m_optimize(desc);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "pipeline registry: optimizing " << desc.vertexShader << " + " << desc.fragmentShader << ": " << e.what() << std::endl;
+		}
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - optimizeBegin).count();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry.optimizing = false;
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			m_replaced.push_back(entry.pipeline.exchange(pipeline, std::memory_order_acq_rel));
+			m_stats.optimized++;
+			m_stats.optimizeMilliseconds += milliseconds;
+		}
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+// scoped wall clock timers for startup: every PROFILE_SCOPE records when it was entered and left, scopes opened inside
+// it become its children, scopes of other threads (startup jobs) end up in trees of their own
+//
+//   void createTextureImage() {
+//       PROFILE_SCOPE("createTextureImage");
+//       { PROFILE_SCOPE("decode"); ... }
+//       { PROFILE_SCOPE("upload"); ... }
+//   }
+//   Profiler::printSummary(std::cout);               // indented tree with the time of every scope
+//   Profiler::writeChromeTrace("startup_trace.json"); // open in chrome://tracing or https://ui.perfetto.dev
+//
+// without ENABLE_STARTUP_PROFILER (defined in Debug builds) PROFILE_SCOPE expands to nothing, so it costs nothing
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef ENABLE_STARTUP_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+class Profiler {
+public:
+	// name has to outlive the profiler (string literals)
+	static size_t begin(const char* name)
+	{
+		if (!state().recording.load(std::memory_order_relaxed))
+		{
+			return NotRecorded;
+		}
+		Record record;
+		record.name = name;
+		record.thread = std::this_thread::get_id();
+		record.depth = t_depth++;
+		record.start = now();
+		std::lock_guard<std::mutex> lock(state().mutex);
+		state().records.push_back(record);
+		return state().records.size() - 1;
+	}
+
+	static void end(size_t index)
+	{
+		if (index == NotRecorded)
+		{
+			return;
+		}
+		double end = now();
+		t_depth--;
+		std::lock_guard<std::mutex> lock(state().mutex);
+		Record& record = state().records[index];
+		record.duration = end - record.start;
+	}
+
+	// one line per scope, children indented below their parent, threads one after the other
+	static void printSummary(std::ostream& out)
+	{
+		std::vector<Record> records = sortedRecords();
+		std::vector<std::thread::id> threads;
+		out << "startup profile:\n";
+		for (const Record& record : records)
+		{
+			if (std::find(threads.begin(), threads.end(), record.thread) == threads.end())
+			{
+				threads.push_back(record.thread);
+				out << "  thread " << threads.size() - 1 << (threads.size() == 1 ? " (main)" : "") << "\n";
+			}
+			out << "    " << std::string(record.depth * 2, ' ') << std::left << std::setw(40 - std::min<int>(record.depth * 2, 38))
+				<< record.name << std::right << std::fixed << std::setprecision(2) << std::setw(10) << record.duration / 1000.0 << " ms\n";
+		}
+		out << std::defaultfloat;
+	}
+
+	// Chrome trace event format, one complete ("X") event per scope
+	static bool writeChromeTrace(const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+		std::vector<Record> records = sortedRecords();
+		std::vector<std::thread::id> threads;
+		file << "{\"traceEvents\":[\n";
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const Record& record = records[i];
+			auto thread = std::find(threads.begin(), threads.end(), record.thread);
+			if (thread == threads.end())
+			{
+				thread = threads.insert(threads.end(), record.thread);
+			}
+			file << "{\"name\":\"" << record.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (thread - threads.begin())
+				<< std::fixed << std::setprecision(3) << ",\"ts\":" << record.start << ",\"dur\":" << record.duration << "}"
+				<< (i + 1 < records.size() ? ",\n" : "\n");
+		}
+		file << "]}\n";
+		return true;
+	}
+
+	// scopes which begin afterwards are not recorded (the same functions run again on resize)
+	static void stop()
+	{
+		state().recording = false;
+	}
+
+	static void clear()
+	{
+		std::lock_guard<std::mutex> lock(state().mutex);
+		state().records.clear();
+	}
+
+private:
+	struct Record {
+		const char* name = "";
+		std::thread::id thread;
+		uint32_t depth = 0; // scopes of the same thread which were open when this one began
+		double start = 0.0; // microseconds since the profiler was first used
+		double duration = 0.0; // microseconds, 0 while the scope is open
+	};
+	struct State {
+		std::mutex mutex;
+		std::vector<Record> records; // in the order the scopes began
+		std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+		std::atomic<bool> recording{ true };
+	};
+	static constexpr size_t NotRecorded = SIZE_MAX;
+
+	static inline thread_local uint32_t t_depth = 0;
+
+	static State& state()
+	{
+		static State instance;
+		return instance;
+	}
+
+	static double now()
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - state().origin).count();
+	}
+
+	// grouped by thread (in the order the threads showed up), each thread's scopes in the order they began,
+	// so every scope comes right after its parent
+	static std::vector<Record> sortedRecords()
+	{
+		std::vector<Record> records;
+		{
+			std::lock_guard<std::mutex> lock(state().mutex);
+			records = state().records;
+		}
+		std::vector<std::thread::id> threads;
+		for (const Record& record : records)
+		{
+			if (std::find(threads.begin(), threads.end(), record.thread) == threads.end())
+			{
+				threads.push_back(record.thread);
+			}
+		}
+		std::stable_sort(records.begin(), records.end(), [&threads](const Record& a, const Record& b) {
+			return std::find(threads.begin(), threads.end(), a.thread) < std::find(threads.begin(), threads.end(), b.thread);
+		});
+		return records;
+	}
+};
+
+// records the scope it lives in, use it through PROFILE_SCOPE
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name) : m_index(Profiler::begin(name)) {}
+	~ProfileScope() { Profiler::end(m_index); }
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	size_t m_index;
+};
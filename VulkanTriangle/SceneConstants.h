@@ -0,0 +1,16 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// what the shaders read per object, laid out the way they declare it
+
+// shader.vert's uniform buffer
+struct UniformBufferObject {
+	alignas(16) glm::mat4 model;
+	alignas(16) glm::mat4 view;
+	alignas(16) glm::mat4 proj;
+};
+
+// push constants of shader_mvp.vert, one per object (nothing is lit, so there is no normal matrix yet)
+struct ObjectTransform {
+	glm::mat4 mvp{ 1.0f }; // proj * view * model
+};
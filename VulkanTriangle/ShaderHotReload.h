@@ -0,0 +1,169 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <iostream>
+#include <shaderc/shaderc.hpp>
+#include "JobSystem.h"
+
+// recompiles GLSL sources in the background whenever they change on disk, so shaders can be edited while the application runs
+//
+// every source has the SPIR-V file the pipelines are built from, once all changed sources compile the new code replaces
+// what is read from that file and the revision goes up:
+//
+//   uint64_t revision = hotReload.poll();        // once per frame, cheap (looks at the files a few times a second)
+//   if (revision > desc.shaderRevision) { ...build the pipelines again with desc.shaderRevision = revision... }
+//   ...
+//   std::vector<uint32_t> code;
+//   if (!hotReload.code(desc.vertexShader, code)) ...use the embedded code (see EmbeddedShaders.h)...
+//
+// sources which do not compile are reported and leave the current code alone
+
+struct ShaderSource {
+	std::string glslPath; // watched and compiled
+	std::string spirvPath; // what pipeline descriptions refer to
+	shaderc_shader_kind kind;
+};
+
+struct ShaderHotReloadStats {
+	uint32_t reloads = 0; // revisions published
+	uint32_t failures = 0; // recompiles which did not compile
+	double lastCompileMilliseconds = 0.0;
+};
+
+class ShaderHotReload {
+public:
+	void init(JobSystem& jobs, std::vector<ShaderSource> sources)
+	{
+		m_jobs = &jobs;
+		m_sources = std::move(sources);
+		for (const ShaderSource& source : m_sources)
+		{
+			m_writeTimes.push_back(writeTime(source.glslPath));
+		}
+		m_lastCheck = std::chrono::steady_clock::now();
+	}
+
+	// waits for a recompile which is still running
+	void destroy()
+	{
+		m_jobs->wait(m_compiling);
+	}
+
+	// starts a recompile if a source changed, returns the newest revision whose code is complete (0 = the SPIR-V files)
+	uint64_t poll()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (m_compiling.done() && now - m_lastCheck > std::chrono::milliseconds(250))
+		{
+			m_lastCheck = now;
+			bool changed = false;
+			for (size_t i = 0; i < m_sources.size(); i++)
+			{
+				std::filesystem::file_time_type time = writeTime(m_sources[i].glslPath);
+				if (time != m_writeTimes[i])
+				{
+					m_writeTimes[i] = time;
+					changed = true;
+				}
+			}
+			// editors often write a file in several steps, compiling all sources again keeps them consistent
+			// without worker threads nobody would pick up the job, the caller compiles right away (a hitch, but it reloads)
+			if (changed && m_jobs->threadCount() < 2)
+			{
+				compileAll();
+			}
+			else if (changed)
+			{
+				m_jobs->run([this]() { compileAll(); }, &m_compiling);
+			}
+		}
+		return m_revision.load(std::memory_order_acquire);
+	}
+
+	// the recompiled code for spirvPath, false if it has not been reloaded yet (read the file instead)
+	bool code(const std::string& spirvPath, std::vector<uint32_t>& code) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_code.find(spirvPath);
+		if (it == m_code.end())
+		{
+			return false;
+		}
+		code = it->second;
+		return true;
+	}
+
+	ShaderHotReloadStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		ShaderHotReloadStats current = stats();
+		out << "shader hot reload: " << current.reloads << " reloads, " << current.failures << " failed recompiles\n";
+	}
+
+private:
+	JobSystem* m_jobs = nullptr;
+	std::vector<ShaderSource> m_sources;
+	std::vector<std::filesystem::file_time_type> m_writeTimes; // last seen, one per source
+	std::chrono::steady_clock::time_point m_lastCheck;
+	JobCounter m_compiling; // the recompile job, there is at most one at a time
+	std::atomic<uint64_t> m_revision{ 0 };
+	mutable std::mutex m_mutex; // guards m_code and m_stats
+	std::unordered_map<std::string, std::vector<uint32_t>> m_code; // spirvPath -> recompiled code
+	ShaderHotReloadStats m_stats;
+
+	static std::filesystem::file_time_type writeTime(const std::string& path)
+	{
+		std::error_code error;
+		return std::filesystem::last_write_time(path, error);
+	}
+
+	// runs as a job
+	void compileAll()
+	{
+		auto compileBegin = std::chrono::high_resolution_clock::now();
+		shaderc::Compiler compiler;
+		shaderc::CompileOptions options;
+		options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+		std::unordered_map<std::string, std::vector<uint32_t>> compiled;
+		for (const ShaderSource& source : m_sources)
+		{
+			std::ifstream file(source.glslPath);
+			std::stringstream text;
+			text << file.rdbuf();
+			shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(text.str(), source.kind, source.glslPath.c_str(), options);
+			if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+			{
+				std::cerr << "shader hot reload: " << result.GetErrorMessage();
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stats.failures++;
+				return;
+			}
+			compiled[source.spirvPath].assign(result.cbegin(), result.cend());
+		}
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileBegin).count();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& [spirvPath, code] : compiled)
+		{
+			m_code[spirvPath] = std::move(code);
+		}
+		m_stats.reloads++;
+		m_stats.lastCompileMilliseconds = milliseconds;
+		m_revision.fetch_add(1, std::memory_order_release);
+		std::cout << "shader hot reload: revision " << m_revision.load() << " compiled in " << milliseconds << " ms\n";
+	}
+};
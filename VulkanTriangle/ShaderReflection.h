@@ -0,0 +1,496 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <spirv-headers/spirv.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// what a shader expects from the application, read straight out of its SPIR-V: descriptor bindings, push constants
+// and (for vertex shaders) the vertex inputs
+//
+//   ShaderReflection interface = reflectShader(vertWords, vertWordCount, VK_SHADER_STAGE_VERTEX_BIT);
+//   interface.merge(reflectShader(fragWords, fragWordCount, VK_SHADER_STAGE_FRAGMENT_BIT));   // the whole pipeline
+//   interface.setBindings(0)            -> VkDescriptorSetLayoutBinding for set 0, stage flags of every stage using them
+//   interface.vertexAttributes(0, stride) -> inputs packed one after the other in location order
+//   interface.specializationConstants   -> constant ids which can be set at pipeline creation
+//   interface.makeDynamic("ubo")        -> the buffer is bound with a dynamic offset (UNIFORM_BUFFER_DYNAMIC)
+//
+// only what this renderer needs is understood, anything else in the module is skipped
+
+struct ReflectedBinding {
+	uint32_t set = 0;
+	uint32_t binding = 0;
+	VkDescriptorType type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	uint32_t count = 1; // array size
+	VkShaderStageFlags stages = 0;
+	uint32_t size = 0; // bytes, uniform and storage buffers only
+	std::string name; // the variable's name in the shader, empty without debug info
+};
+
+struct ReflectedVertexInput {
+	uint32_t location = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t size = 0; // bytes
+	std::string name;
+};
+
+struct ShaderReflection {
+	VkShaderStageFlags stages = 0;
+	std::vector<ReflectedBinding> bindings; // sorted by set, then binding
+	std::vector<VkPushConstantRange> pushConstants; // at most one range, covering every stage's block
+	std::vector<ReflectedVertexInput> vertexInputs; // sorted by location
+	std::vector<uint32_t> specializationConstants; // constant ids the stages declare
+
+	// adds another stage of the same pipeline, throws if both use a binding in different ways
+	void merge(const ShaderReflection& other)
+	{
+		stages |= other.stages;
+		for (const ReflectedBinding& binding : other.bindings)
+		{
+			ReflectedBinding* existing = find(binding.set, binding.binding);
+			if (existing == nullptr)
+			{
+				bindings.push_back(binding);
+				continue;
+			}
+			if (existing->type != binding.type || existing->count != binding.count)
+			{
+				throw std::runtime_error("failed to merge shader stages, binding " + std::to_string(binding.binding) + " differs!");
+			}
+			existing->stages |= binding.stages;
+			existing->size = std::max(existing->size, binding.size);
+		}
+		std::sort(bindings.begin(), bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+			return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+		});
+		for (const VkPushConstantRange& range : other.pushConstants)
+		{
+			if (pushConstants.empty())
+			{
+				pushConstants.push_back(range);
+				continue;
+			}
+			uint32_t end = std::max(pushConstants[0].offset + pushConstants[0].size, range.offset + range.size);
+			pushConstants[0].offset = std::min(pushConstants[0].offset, range.offset);
+			pushConstants[0].size = end - pushConstants[0].offset;
+			pushConstants[0].stageFlags |= range.stageFlags;
+		}
+		if (!other.vertexInputs.empty())
+		{
+			vertexInputs = other.vertexInputs;
+		}
+		for (uint32_t constantId : other.specializationConstants)
+		{
+			if (std::find(specializationConstants.begin(), specializationConstants.end(), constantId) == specializationConstants.end())
+			{
+				specializationConstants.push_back(constantId);
+			}
+		}
+	}
+
+	// true if a pipeline layout made for layout runs these shaders: it has every binding they use (same type and count,
+	// visible to the stages using it) and a push constant range covering theirs, anything else it declares goes unused
+	// (a dynamic buffer is the same binding to the shader as a plain one)
+	bool fits(const ShaderReflection& layout) const
+	{
+		for (const ReflectedBinding& binding : bindings)
+		{
+			auto declared = std::find_if(layout.bindings.begin(), layout.bindings.end(), [&](const ReflectedBinding& other) {
+				return other.set == binding.set && other.binding == binding.binding;
+			});
+			if (declared == layout.bindings.end() || withoutDynamicOffset(declared->type) != withoutDynamicOffset(binding.type) ||
+				declared->count != binding.count ||
+				(declared->stages & binding.stages) != binding.stages)
+			{
+				return false;
+			}
+		}
+		for (const VkPushConstantRange& range : pushConstants)
+		{
+			bool covered = std::any_of(layout.pushConstants.begin(), layout.pushConstants.end(), [&](const VkPushConstantRange& other) {
+				return other.offset <= range.offset && other.offset + other.size >= range.offset + range.size &&
+					(other.stageFlags & range.stageFlags) == range.stageFlags;
+			});
+			if (!covered)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// binds the uniform or storage buffer called name with a dynamic offset, SPIR-V looks the same either way so only the
+	// application knows, false if there is no such buffer
+	bool makeDynamic(const std::string& name)
+	{
+		for (ReflectedBinding& reflected : bindings)
+		{
+			if (reflected.name != name) continue;
+			if (reflected.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) reflected.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			else if (reflected.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) reflected.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			else return false;
+			return true;
+		}
+		return false;
+	}
+
+	static VkDescriptorType withoutDynamicOffset(VkDescriptorType type)
+	{
+		if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		if (type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		return type;
+	}
+
+	ReflectedBinding* find(uint32_t set, uint32_t binding)
+	{
+		for (ReflectedBinding& reflected : bindings)
+		{
+			if (reflected.set == set && reflected.binding == binding) return &reflected;
+		}
+		return nullptr;
+	}
+
+	// by the name of the variable in the shader, nullptr if there is none
+	const ReflectedBinding* find(const std::string& name) const
+	{
+		for (const ReflectedBinding& reflected : bindings)
+		{
+			if (reflected.name == name) return &reflected;
+		}
+		return nullptr;
+	}
+
+	// number of descriptor sets the pipeline layout needs (highest set used + 1)
+	uint32_t setCount() const
+	{
+		return bindings.empty() ? 0 : bindings.back().set + 1;
+	}
+
+	std::vector<VkDescriptorSetLayoutBinding> setBindings(uint32_t set) const
+	{
+		std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+		for (const ReflectedBinding& reflected : bindings)
+		{
+			if (reflected.set != set) continue;
+			VkDescriptorSetLayoutBinding layoutBinding{};
+			layoutBinding.binding = reflected.binding;
+			layoutBinding.descriptorType = reflected.type;
+			layoutBinding.descriptorCount = reflected.count;
+			layoutBinding.stageFlags = reflected.stages;
+			layoutBindings.push_back(layoutBinding);
+		}
+		return layoutBindings;
+	}
+
+	// descriptors needed to allocate setsPerLayout sets of every layout
+	std::vector<VkDescriptorPoolSize> poolSizes(uint32_t setsPerLayout) const
+	{
+		std::vector<VkDescriptorPoolSize> sizes;
+		for (const ReflectedBinding& reflected : bindings)
+		{
+			auto size = std::find_if(sizes.begin(), sizes.end(), [&](const VkDescriptorPoolSize& s) { return s.type == reflected.type; });
+			if (size == sizes.end())
+			{
+				size = sizes.insert(sizes.end(), VkDescriptorPoolSize{ reflected.type, 0 });
+			}
+			size->descriptorCount += reflected.count * setsPerLayout;
+		}
+		return sizes;
+	}
+
+	// one interleaved vertex buffer: every input follows the previous one, stride is their total size
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes(uint32_t binding, uint32_t& stride) const
+	{
+		std::vector<VkVertexInputAttributeDescription> attributes;
+		stride = 0;
+		for (const ReflectedVertexInput& input : vertexInputs)
+		{
+			attributes.push_back({ input.location, binding, input.format, stride });
+			stride += input.size;
+		}
+		return attributes;
+	}
+};
+
+namespace spirv_reflection_detail {
+
+	struct Type {
+		SpvOp op = SpvOpNop;
+		std::vector<uint32_t> operands; // of the OpType* instruction, the result id left out
+	};
+
+	struct Decorations {
+		uint32_t set = 0;
+		uint32_t binding = 0;
+		uint32_t location = UINT32_MAX;
+		uint32_t arrayStride = 0;
+		bool builtIn = false;
+		bool block = false;
+		bool bufferBlock = false;
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	struct Module {
+		std::unordered_map<uint32_t, Type> types;
+		std::unordered_map<uint32_t, uint32_t> constants; // 32 bit integer constants (array lengths)
+		std::unordered_map<uint32_t, Decorations> decorations;
+		std::unordered_map<uint32_t, std::string> names;
+
+		const Type& type(uint32_t id) const
+		{
+			auto it = types.find(id);
+			if (it == types.end())
+			{
+				throw std::runtime_error("failed to reflect shader, unknown type!");
+			}
+			return it->second;
+		}
+
+		// bytes the type occupies in a buffer block (offsets and strides as decorated by the compiler)
+		uint32_t size(uint32_t id, uint32_t matrixStride = 0) const
+		{
+			const Type& t = type(id);
+			switch (t.op)
+			{
+			case SpvOpTypeBool:
+				return 4;
+			case SpvOpTypeInt:
+			case SpvOpTypeFloat:
+				return t.operands[0] / 8;
+			case SpvOpTypeVector:
+				return size(t.operands[0]) * t.operands[1];
+			case SpvOpTypeMatrix:
+				return (matrixStride != 0 ? matrixStride : size(t.operands[0])) * t.operands[1];
+			case SpvOpTypeArray: {
+				auto found = decorations.find(id);
+				uint32_t stride = found != decorations.end() && found->second.arrayStride != 0 ? found->second.arrayStride : size(t.operands[0], matrixStride);
+				return stride * constants.at(t.operands[1]);
+			}
+			case SpvOpTypeRuntimeArray:
+				return 0;
+			case SpvOpTypeStruct: {
+				auto found = decorations.find(id);
+				uint32_t end = 0;
+				for (size_t member = 0; member < t.operands.size(); member++)
+				{
+					uint32_t offset = 0;
+					uint32_t memberMatrixStride = 0;
+					if (found != decorations.end() && member < found->second.memberOffsets.size())
+					{
+						offset = found->second.memberOffsets[member];
+						memberMatrixStride = found->second.memberMatrixStrides[member];
+					}
+					end = std::max(end, offset + size(t.operands[member], memberMatrixStride));
+				}
+				return end;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		// offset of the first member of a block, push constant ranges start there
+		uint32_t firstOffset(uint32_t structId) const
+		{
+			auto found = decorations.find(structId);
+			if (found == decorations.end() || found->second.memberOffsets.empty()) return 0;
+			return *std::min_element(found->second.memberOffsets.begin(), found->second.memberOffsets.end());
+		}
+
+		VkFormat vertexFormat(uint32_t id, uint32_t& bytes) const
+		{
+			const Type& t = type(id);
+			uint32_t components = 1;
+			const Type* scalar = &t;
+			if (t.op == SpvOpTypeVector)
+			{
+				components = t.operands[1];
+				scalar = &type(t.operands[0]);
+			}
+			bytes = size(id);
+			static const VkFormat floats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			static const VkFormat ints[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			static const VkFormat uints[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+			if (components < 1 || components > 4 || scalar->operands[0] != 32)
+			{
+				throw std::runtime_error("failed to reflect shader, unsupported vertex input type!");
+			}
+			if (scalar->op == SpvOpTypeFloat) return floats[components - 1];
+			if (scalar->op == SpvOpTypeInt) return scalar->operands[1] ? ints[components - 1] : uints[components - 1];
+			throw std::runtime_error("failed to reflect shader, unsupported vertex input type!");
+		}
+	};
+
+	inline std::string literalString(const uint32_t* words, size_t wordCount)
+	{
+		const char* text = reinterpret_cast<const char*>(words);
+		return std::string(text, strnlen(text, wordCount * sizeof(uint32_t)));
+	}
+}
+
+// reads the interface of one shader module (codeWords 32 bit words, e.g. an embedded array), throws if it is not SPIR-V
+inline ShaderReflection reflectShader(const uint32_t* words, size_t codeWords, VkShaderStageFlagBits stage)
+{
+	using namespace spirv_reflection_detail;
+	if (codeWords < 5 || words[0] != SpvMagicNumber)
+	{
+		throw std::runtime_error("failed to reflect shader, not SPIR-V!");
+	}
+
+	// first pass: types, constants, names and decorations (they all come before the variables, but not in a useful order)
+	struct Variable { uint32_t pointerType; uint32_t id; SpvStorageClass storage; };
+	Module module;
+	std::vector<Variable> variables;
+	std::vector<uint32_t> specializationConstants;
+	for (size_t i = 5; i < codeWords;)
+	{
+		uint32_t wordCount = words[i] >> SpvWordCountShift;
+		SpvOp op = static_cast<SpvOp>(words[i] & SpvOpCodeMask);
+		if (wordCount == 0 || i + wordCount > codeWords)
+		{
+			throw std::runtime_error("failed to reflect shader, truncated instruction!");
+		}
+		const uint32_t* operands = &words[i + 1];
+		uint32_t operandCount = wordCount - 1;
+		switch (op)
+		{
+		case SpvOpName:
+			module.names[operands[0]] = literalString(operands + 1, operandCount - 1);
+			break;
+		case SpvOpDecorate: {
+			Decorations& decorations = module.decorations[operands[0]];
+			switch (operands[1])
+			{
+			case SpvDecorationDescriptorSet: decorations.set = operands[2]; break;
+			case SpvDecorationBinding: decorations.binding = operands[2]; break;
+			case SpvDecorationLocation: decorations.location = operands[2]; break;
+			case SpvDecorationArrayStride: decorations.arrayStride = operands[2]; break;
+			case SpvDecorationBuiltIn: decorations.builtIn = true; break;
+			case SpvDecorationBlock: decorations.block = true; break;
+			case SpvDecorationBufferBlock: decorations.bufferBlock = true; break;
+			case SpvDecorationSpecId: specializationConstants.push_back(operands[2]); break;
+			default: break;
+			}
+			break;
+		}
+		case SpvOpMemberDecorate: {
+			Decorations& decorations = module.decorations[operands[0]];
+			uint32_t member = operands[1];
+			if (decorations.memberOffsets.size() <= member)
+			{
+				decorations.memberOffsets.resize(member + 1, 0);
+				decorations.memberMatrixStrides.resize(member + 1, 0);
+			}
+			if (operands[2] == SpvDecorationOffset) decorations.memberOffsets[member] = operands[3];
+			if (operands[2] == SpvDecorationMatrixStride) decorations.memberMatrixStrides[member] = operands[3];
+			break;
+		}
+		case SpvOpTypeBool: case SpvOpTypeInt: case SpvOpTypeFloat: case SpvOpTypeVector: case SpvOpTypeMatrix:
+		case SpvOpTypeImage: case SpvOpTypeSampler: case SpvOpTypeSampledImage: case SpvOpTypeArray:
+		case SpvOpTypeRuntimeArray: case SpvOpTypeStruct: case SpvOpTypePointer:
+			module.types[operands[0]] = Type{ op, std::vector<uint32_t>(operands + 1, operands + operandCount) };
+			break;
+		case SpvOpConstant:
+			module.constants[operands[1]] = operands[2];
+			break;
+		case SpvOpVariable:
+			variables.push_back({ operands[0], operands[1], static_cast<SpvStorageClass>(operands[2]) });
+			break;
+		default:
+			break;
+		}
+		i += wordCount;
+	}
+
+	// second pass: what every interface variable means for the application
+	ShaderReflection reflection;
+	reflection.stages = stage;
+	reflection.specializationConstants = specializationConstants;
+	for (const Variable& variable : variables)
+	{
+		uint32_t typeId = module.type(variable.pointerType).operands[1]; // OpTypePointer: storage class, pointee
+		const Decorations& decorations = module.decorations[variable.id];
+		auto name = module.names.find(variable.id);
+
+		if (variable.storage == SpvStorageClassInput)
+		{
+			if (stage != VK_SHADER_STAGE_VERTEX_BIT || decorations.builtIn || decorations.location == UINT32_MAX ||
+				module.decorations[typeId].block)
+			{
+				continue;
+			}
+			ReflectedVertexInput input;
+			input.location = decorations.location;
+			input.format = module.vertexFormat(typeId, input.size);
+			input.name = name != module.names.end() ? name->second : "";
+			reflection.vertexInputs.push_back(input);
+			continue;
+		}
+		if (variable.storage == SpvStorageClassPushConstant)
+		{
+			uint32_t offset = module.firstOffset(typeId);
+			reflection.pushConstants.push_back({ static_cast<VkShaderStageFlags>(stage), offset, module.size(typeId) - offset });
+			continue;
+		}
+		if (variable.storage != SpvStorageClassUniform && variable.storage != SpvStorageClassUniformConstant &&
+			variable.storage != SpvStorageClassStorageBuffer)
+		{
+			continue;
+		}
+
+		ReflectedBinding binding;
+		binding.set = decorations.set;
+		binding.binding = decorations.binding;
+		binding.stages = stage;
+		binding.name = name != module.names.end() ? name->second : "";
+		// arrays of descriptors (runtime sized ones count as one, the application has to know how many it binds)
+		const Type* type = &module.type(typeId);
+		if (type->op == SpvOpTypeArray || type->op == SpvOpTypeRuntimeArray)
+		{
+			binding.count = type->op == SpvOpTypeArray ? module.constants.at(type->operands[1]) : 1;
+			typeId = type->operands[0];
+			type = &module.type(typeId);
+		}
+
+		switch (type->op)
+		{
+		case SpvOpTypeSampledImage:
+			binding.type = module.type(type->operands[0]).operands[1] == SpvDimBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+				: VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			break;
+		case SpvOpTypeSampler:
+			binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			break;
+		case SpvOpTypeImage: {
+			// OpTypeImage: sampled type, dim, depth, arrayed, multisampled, sampled (1 = with a sampler, 2 = storage), format
+			uint32_t dim = type->operands[1];
+			bool storage = type->operands[5] == 2;
+			if (dim == SpvDimSubpassData) binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			else if (dim == SpvDimBuffer) binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			break;
+		}
+		case SpvOpTypeStruct:
+			binding.type = variable.storage == SpvStorageClassStorageBuffer || module.decorations[typeId].bufferBlock
+				? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			binding.size = module.size(typeId);
+			break;
+		default:
+			continue; // acceleration structures and the like, not used here
+		}
+		reflection.bindings.push_back(binding);
+	}
+
+	std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(), [](const ReflectedVertexInput& a, const ReflectedVertexInput& b) {
+		return a.location < b.location;
+	});
+	return reflection;
+}
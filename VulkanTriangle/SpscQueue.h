@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+// lock free queue between exactly one producer thread and one consumer thread
+// the elements live in a fixed ring of Capacity slots, so a full queue makes the producer wait instead of allocating:
+// with Capacity 3 the producer can fill one slot while the consumer works on another (triple buffering)
+//
+//   producer: if (!queue.tryPush(packet)) { /* consumer is behind, do something else */ }
+//   consumer: Packet packet; if (queue.tryPop(packet)) { use(packet); }
+//   consumer: while (queue.waitPop(packet)) { use(packet); }   // sleeps while the queue is empty, until wake()
+//
+// pushing and popping never lock, only a consumer which went to sleep is woken through a mutex and condition variable
+
+template<typename T, size_t Capacity>
+class SpscQueue {
+public:
+	// producer only, false if every slot is taken
+	bool tryPush(const T& value)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) % SlotCount;
+		if (next == m_head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		m_slots[tail] = value;
+		// publishes the slot's contents together with the new tail
+		m_tail.store(next, std::memory_order_release);
+		// pairs with the fence in waitPop(): either the consumer sees the new tail or the producer sees it sleeping
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_consumerSleeping.load(std::memory_order_relaxed))
+		{
+			// taking the mutex orders the push before the consumer's check or after it went to sleep, never in between
+			{ std::lock_guard<std::mutex> lock(m_sleepMutex); }
+			m_wakeUp.notify_one();
+		}
+		return true;
+	}
+
+	// consumer only, blocks until something has been pushed, false if wake() was called with nothing to pop
+	bool waitPop(T& value)
+	{
+		if (tryPop(value))
+		{
+			return true;
+		}
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_consumerSleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		m_wakeUp.wait(lock, [this]() { return m_wakeRequested || size() > 0; });
+		m_consumerSleeping.store(false, std::memory_order_relaxed);
+		m_wakeRequested = false;
+		return tryPop(value);
+	}
+
+	// any thread, makes a sleeping waitPop() return (e.g. to let the consumer see that it has to quit)
+	void wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_wakeRequested = true;
+		}
+		m_wakeUp.notify_one();
+	}
+
+	// consumer only, false if nothing has been pushed
+	bool tryPop(T& value)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		value = m_slots[head];
+		// hands the slot back to the producer
+		m_head.store((head + 1) % SlotCount, std::memory_order_release);
+		return true;
+	}
+
+	// only a snapshot when called while the other thread is working
+	size_t size() const
+	{
+		size_t head = m_head.load(std::memory_order_acquire);
+		size_t tail = m_tail.load(std::memory_order_acquire);
+		return (tail + SlotCount - head) % SlotCount;
+	}
+
+private:
+	// one slot stays empty to tell a full ring from an empty one
+	static constexpr size_t SlotCount = Capacity + 1;
+
+	std::array<T, SlotCount> m_slots{};
+	// on separate cache lines, each index is written by one thread only
+	alignas(64) std::atomic<size_t> m_head{ 0 }; // next slot the consumer reads
+	alignas(64) std::atomic<size_t> m_tail{ 0 }; // next slot the producer writes
+
+	std::atomic<bool> m_consumerSleeping{ false }; // the producer only touches the mutex while this is set
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeUp;
+	bool m_wakeRequested = false; // guarded by m_sleepMutex
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include "MemoryAllocator.h"
+#include "Profiler.h"
+
+// reusable staging memory for uploads
+// instead of creating, mapping and destroying a staging buffer per upload, data is copied into persistently mapped
+// host visible chunks. An upload bigger than what is left in a chunk is split across several chunks.
+// Chunks are tagged with the submission that reads them and are recycled once that submission has completed.
+// Submissions are identified by monotonically increasing values (one per submit), the owner reports which
+// value has been submitted and which one has completed.
+
+// a piece of an upload that ended up in one chunk
+struct StagingSpan {
+	VkBuffer buffer = VK_NULL_HANDLE; // staging buffer to copy from
+	VkDeviceSize offset = 0; // offset of the data inside buffer
+	VkDeviceSize size = 0; // bytes in this span
+	VkDeviceSize sourceOffset = 0; // where the span starts inside the uploaded data
+};
+
+struct StagingPoolStats {
+	uint32_t chunkCount = 0; // chunks created so far
+	uint32_t chunksInFlight = 0; // chunks waiting for their submission to complete
+	uint64_t bytesStaged = 0; // total bytes copied through the pool
+	uint64_t uploadCount = 0; // total number of stage() calls
+	uint64_t splitUploads = 0; // uploads which had to be split across chunks
+};
+
+class StagingPool {
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, DeviceMemoryAllocator& allocator, VkDeviceSize chunkSize = 4 * 1024 * 1024)
+	{
+		m_device = device;
+		m_allocator = &allocator;
+		m_chunkSize = chunkSize;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		// 4 covers vkCmdCopyBuffer and RGBA8 vkCmdCopyBufferToImage, the optimal alignment makes copies faster
+		m_alignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 4);
+	}
+
+	void destroy()
+	{
+		for (Chunk& chunk : m_chunks)
+		{
+			vkDestroyBuffer(m_device, chunk.buffer, nullptr);
+			m_allocator->free(chunk.memory);
+		}
+		m_chunks.clear();
+	}
+
+	// copies size bytes into staging memory, the result is one span per chunk the data landed in
+	// spans are only split at multiples of splitGranularity (e.g. the row pitch of an image), which has to fit into a chunk
+	std::vector<StagingSpan> stage(const void* data, VkDeviceSize size, VkDeviceSize splitGranularity = 1)
+	{
+		PROFILE_SCOPE("stage");
+		if (splitGranularity > m_chunkSize)
+		{
+			throw std::invalid_argument("staging pool: split granularity is bigger than a chunk");
+		}
+		std::vector<StagingSpan> spans;
+		VkDeviceSize copied = 0;
+		while (copied < size)
+		{
+			Chunk& chunk = currentChunk(std::min(size - copied, splitGranularity));
+			VkDeviceSize start = alignUp(chunk.used, m_alignment);
+			// as much as fits, cut at the split granularity unless everything that is left fits
+			VkDeviceSize room = m_chunkSize - start;
+			VkDeviceSize spanSize = size - copied;
+			if (spanSize > room)
+			{
+				spanSize = room / splitGranularity * splitGranularity;
+			}
+
+			memcpy(static_cast<char*>(chunk.memory.mappedData) + start, static_cast<const char*>(data) + copied, static_cast<size_t>(spanSize));
+			chunk.used = start + spanSize;
+			chunk.pending = true;
+
+			StagingSpan span;
+			span.buffer = chunk.buffer;
+			span.offset = start;
+			span.size = spanSize;
+			span.sourceOffset = copied;
+			spans.push_back(span);
+			copied += spanSize;
+		}
+		m_stats.bytesStaged += size;
+		m_stats.uploadCount++;
+		if (spans.size() > 1) m_stats.splitUploads++;
+		return spans;
+	}
+
+	// the copies reading everything staged since the last call were submitted as submission "value"
+	void markSubmitted(uint64_t value)
+	{
+		for (uint32_t i = 0; i < m_chunks.size(); i++)
+		{
+			if (m_chunks[i].pending)
+			{
+				m_chunks[i].pending = false;
+				m_chunks[i].inFlight = true;
+				m_chunks[i].submission = value;
+			}
+		}
+		// new data goes into a fresh chunk so a chunk is never shared by two submissions
+		m_current = NO_CHUNK;
+	}
+
+	// every submission up to and including completedValue has finished on the GPU, their chunks can be reused
+	void recycle(uint64_t completedValue)
+	{
+		for (Chunk& chunk : m_chunks)
+		{
+			if (chunk.inFlight && chunk.submission <= completedValue)
+			{
+				chunk.inFlight = false;
+				chunk.used = 0;
+			}
+		}
+	}
+
+	StagingPoolStats stats() const
+	{
+		StagingPoolStats stats = m_stats;
+		stats.chunkCount = static_cast<uint32_t>(m_chunks.size());
+		stats.chunksInFlight = static_cast<uint32_t>(std::count_if(m_chunks.begin(), m_chunks.end(), [](const Chunk& chunk) { return chunk.inFlight; }));
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		StagingPoolStats current = stats();
+		out << "staging pool: " << current.chunkCount << " chunks of " << m_chunkSize / 1024 << " KiB (" << current.chunksInFlight << " in flight), "
+			<< current.uploadCount << " uploads, " << current.bytesStaged / 1024 << " KiB staged, " << current.splitUploads << " split across chunks\n";
+	}
+
+private:
+	static constexpr uint32_t NO_CHUNK = ~0u;
+
+	struct Chunk {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkDeviceSize used = 0; // bytes handed out since the chunk was last recycled
+		bool pending = false; // holds data which has not been submitted yet
+		bool inFlight = false; // a submission which reads the chunk has not completed yet
+		uint64_t submission = 0; // the submission which reads the chunk
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceMemoryAllocator* m_allocator = nullptr;
+	VkDeviceSize m_chunkSize = 0;
+	VkDeviceSize m_alignment = 4;
+	std::vector<Chunk> m_chunks;
+	uint32_t m_current = NO_CHUNK; // chunk new data is appended to
+	StagingPoolStats m_stats;
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// the chunk to append to, moves on to a free (or new) chunk if fewer than minBytes are left
+	Chunk& currentChunk(VkDeviceSize minBytes)
+	{
+		if (m_current != NO_CHUNK && alignUp(m_chunks[m_current].used, m_alignment) + minBytes <= m_chunkSize)
+		{
+			return m_chunks[m_current];
+		}
+		for (uint32_t i = 0; i < m_chunks.size(); i++)
+		{
+			if (i != m_current && !m_chunks[i].inFlight && !m_chunks[i].pending)
+			{
+				m_current = i;
+				return m_chunks[i];
+			}
+		}
+		m_chunks.push_back(createChunk());
+		m_current = static_cast<uint32_t>(m_chunks.size() - 1);
+		return m_chunks[m_current];
+	}
+
+	Chunk createChunk()
+	{
+		Chunk chunk;
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = m_chunkSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &chunk.buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create staging chunk!");
+		}
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(m_device, chunk.buffer, &memRequirements);
+		chunk.memory = m_allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MemoryResourceKind::Linear, false);
+		vkBindBufferMemory(m_device, chunk.buffer, chunk.memory.memory, chunk.memory.offset);
+		return chunk;
+	}
+};
@@ -0,0 +1,297 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <glm/glm.hpp>
+
+// import time packing of many small RGBA8 textures into few Vulkan images
+// two modes are supported:
+//   SizeClassArray - textures are grouped by power of two size class, every class becomes one 2D array image (one layer per texture)
+//   Atlas          - textures of any size are bin packed (shelf packing) into pages, the pages become the layers of one 2D array image
+// either way the caller gets back where every source texture ended up, so it can rewrite UVs or hand layer/rect data to a shader
+// a single texture has nothing to share an image with, it is passed through as it is in both modes
+
+enum class TexturePackMode {
+	SizeClassArray,
+	Atlas
+};
+
+// a decoded texture handed to the packer
+struct SourceTexture {
+	std::string name;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels; // width * height * 4 bytes (RGBA8)
+};
+
+// where a source texture ended up after packing
+struct PackedTextureRegion {
+	uint32_t imageIndex = 0; // which packed image (PackedTextureImage) holds the texture
+	uint32_t layer = 0; // array layer inside that image
+	uint32_t x = 0, y = 0; // texel offset of the texture inside the layer
+	uint32_t width = 0, height = 0; // size of the texture in texels
+	glm::vec2 uvOffset{ 0.0f }; // uv of the top left corner of the texture inside the layer
+	glm::vec2 uvScale{ 1.0f }; // size of the texture inside the layer in uv units
+
+	// map a uv in [0, 1] of the original texture to the uv inside the packed layer
+	glm::vec2 remapUV(const glm::vec2& uv) const
+	{
+		return uvOffset + uv * uvScale;
+	}
+};
+
+// one packed Vulkan image, layer after layer of tightly packed RGBA8 texels
+struct PackedTextureImage {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t layerCount = 0;
+	std::vector<uint8_t> pixels; // layerCount * width * height * 4 bytes
+};
+
+// what packing saved us (bytes include the full mip chain)
+struct TexturePackStats {
+	uint32_t sourceImages = 0; // number of VkImage objects without packing
+	uint32_t packedImages = 0; // number of VkImage objects after packing
+	uint32_t packedLayers = 0; // total array layers over all packed images
+	uint64_t sourceBytes = 0; // estimated device memory without packing
+	uint64_t packedBytes = 0; // estimated device memory after packing
+};
+
+struct TexturePackResult {
+	std::vector<PackedTextureImage> images;
+	std::vector<PackedTextureRegion> regions; // one per source texture, same order as the input
+	TexturePackStats stats;
+};
+
+class TexturePacker {
+public:
+	// padding is the number of texels replicated around every texture in atlas mode, so mip levels do not bleed into neighbours
+	// maxPageSize is the largest width/height of an atlas page (keep it within maxImageDimension2D)
+	TexturePacker(TexturePackMode mode, uint32_t padding = 4, uint32_t maxPageSize = 4096)
+		: m_mode(mode), m_padding(padding), m_maxPageSize(maxPageSize)
+	{
+	}
+
+	TexturePackResult pack(const std::vector<SourceTexture>& textures) const
+	{
+		for (const SourceTexture& texture : textures)
+		{
+			if (texture.width == 0 || texture.height == 0 || texture.pixels.size() != size_t(texture.width) * texture.height * 4)
+			{
+				throw std::runtime_error("texture packer: invalid source texture " + texture.name);
+			}
+		}
+
+		TexturePackResult result;
+		result.regions.resize(textures.size());
+		if (textures.size() == 1)
+		{
+			passThrough(textures[0], result);
+		}
+		else if (m_mode == TexturePackMode::SizeClassArray)
+		{
+			packSizeClasses(textures, result);
+		}
+		else
+		{
+			packAtlas(textures, result);
+		}
+
+		// memory estimate: one image per source texture vs the packed images
+		result.stats.sourceImages = static_cast<uint32_t>(textures.size());
+		for (const SourceTexture& texture : textures)
+		{
+			result.stats.sourceBytes += estimateImageBytes(texture.width, texture.height, 1);
+		}
+		result.stats.packedImages = static_cast<uint32_t>(result.images.size());
+		for (const PackedTextureImage& image : result.images)
+		{
+			result.stats.packedLayers += image.layerCount;
+			result.stats.packedBytes += estimateImageBytes(image.width, image.height, image.layerCount);
+		}
+		return result;
+	}
+
+	// device memory of an optimal tiled RGBA8 image with a full mip chain,
+	// every image is rounded up to the 64 KiB alignment drivers typically use for optimal images
+	static uint64_t estimateImageBytes(uint32_t width, uint32_t height, uint32_t layers)
+	{
+		const uint64_t imageAlignment = 64 * 1024;
+		uint64_t bytes = 0;
+		while (true)
+		{
+			bytes += uint64_t(width) * height * 4;
+			if (width == 1 && height == 1) break;
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+		}
+		bytes *= layers;
+		return (bytes + imageAlignment - 1) / imageAlignment * imageAlignment;
+	}
+
+private:
+	TexturePackMode m_mode;
+	uint32_t m_padding;
+	uint32_t m_maxPageSize;
+
+	static uint32_t nextPowerOfTwo(uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result < value) result <<= 1;
+		return result;
+	}
+
+	// copy a texture into a layer at (x, y) and replicate its border texels "padding" times around it
+	static void blit(const SourceTexture& texture, PackedTextureImage& image, uint32_t layer, uint32_t x, uint32_t y, uint32_t padding)
+	{
+		uint8_t* layerPixels = image.pixels.data() + size_t(layer) * image.width * image.height * 4;
+		const int32_t pad = static_cast<int32_t>(padding);
+		for (int32_t row = -pad; row < static_cast<int32_t>(texture.height) + pad; row++)
+		{
+			int32_t dstRow = static_cast<int32_t>(y) + row;
+			if (dstRow < 0 || dstRow >= static_cast<int32_t>(image.height)) continue;
+			int32_t srcRow = std::clamp(row, 0, static_cast<int32_t>(texture.height) - 1);
+			for (int32_t col = -pad; col < static_cast<int32_t>(texture.width) + pad; col++)
+			{
+				int32_t dstCol = static_cast<int32_t>(x) + col;
+				if (dstCol < 0 || dstCol >= static_cast<int32_t>(image.width)) continue;
+				int32_t srcCol = std::clamp(col, 0, static_cast<int32_t>(texture.width) - 1);
+				memcpy(layerPixels + (size_t(dstRow) * image.width + dstCol) * 4,
+					texture.pixels.data() + (size_t(srcRow) * texture.width + srcCol) * 4, 4);
+			}
+		}
+	}
+
+	// one image of the texture's own size, uvs stay as they are
+	static void passThrough(const SourceTexture& texture, TexturePackResult& result)
+	{
+		PackedTextureImage image;
+		image.width = texture.width;
+		image.height = texture.height;
+		image.layerCount = 1;
+		image.pixels = texture.pixels;
+
+		PackedTextureRegion& region = result.regions[0];
+		region.width = texture.width;
+		region.height = texture.height;
+		result.images.push_back(std::move(image));
+	}
+
+	// every (power of two width, power of two height) class becomes one array image with a layer per texture
+	void packSizeClasses(const std::vector<SourceTexture>& textures, TexturePackResult& result) const
+	{
+		std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t>> classes;
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			classes[{ nextPowerOfTwo(textures[i].width), nextPowerOfTwo(textures[i].height) }].push_back(i);
+		}
+
+		for (const auto& [size, members] : classes)
+		{
+			PackedTextureImage image;
+			image.width = size.first;
+			image.height = size.second;
+			image.layerCount = static_cast<uint32_t>(members.size());
+			image.pixels.resize(size_t(image.width) * image.height * 4 * image.layerCount, 0);
+
+			for (uint32_t layer = 0; layer < members.size(); layer++)
+			{
+				const SourceTexture& texture = textures[members[layer]];
+				// textures smaller than their class are padded out with their own border texels
+				blit(texture, image, layer, 0, 0, std::max(image.width - texture.width, image.height - texture.height));
+
+				PackedTextureRegion& region = result.regions[members[layer]];
+				region.imageIndex = static_cast<uint32_t>(result.images.size());
+				region.layer = layer;
+				region.width = texture.width;
+				region.height = texture.height;
+				region.uvScale = { float(texture.width) / image.width, float(texture.height) / image.height };
+			}
+			result.images.push_back(std::move(image));
+		}
+	}
+
+	// shelf packing: textures sorted by height are placed left to right on shelves, shelves stack top to bottom,
+	// a page that runs out of height starts a new layer. All pages share one size since they are layers of the same image.
+	void packAtlas(const std::vector<SourceTexture>& textures, TexturePackResult& result) const
+	{
+		if (textures.empty()) return;
+
+		std::vector<uint32_t> order(textures.size());
+		uint64_t totalArea = 0;
+		uint32_t widestTexture = 0;
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			order[i] = i;
+			uint32_t paddedWidth = textures[i].width + 2 * m_padding;
+			uint32_t paddedHeight = textures[i].height + 2 * m_padding;
+			if (paddedWidth > m_maxPageSize || paddedHeight > m_maxPageSize)
+			{
+				throw std::runtime_error("texture packer: " + textures[i].name + " does not fit into an atlas page");
+			}
+			totalArea += uint64_t(paddedWidth) * paddedHeight;
+			widestTexture = std::max(widestTexture, paddedWidth);
+		}
+		std::sort(order.begin(), order.end(), [&textures](uint32_t a, uint32_t b) {
+			return textures[a].height > textures[b].height;
+			});
+
+		// roughly square pages which are not larger than they need to be
+		uint32_t pageWidth = std::max(widestTexture, static_cast<uint32_t>(std::ceil(std::sqrt(double(totalArea)))));
+		pageWidth = std::min((pageWidth + 3) & ~3u, m_maxPageSize);
+
+		struct Placement { uint32_t page, x, y; };
+		std::vector<Placement> placements(textures.size());
+		uint32_t page = 0, shelfX = 0, shelfY = 0, shelfHeight = 0, pageHeight = 0;
+		for (uint32_t index : order)
+		{
+			uint32_t paddedWidth = textures[index].width + 2 * m_padding;
+			uint32_t paddedHeight = textures[index].height + 2 * m_padding;
+			// start a new shelf if the texture does not fit on the current one
+			if (shelfX + paddedWidth > pageWidth)
+			{
+				shelfY += shelfHeight;
+				shelfX = 0;
+				shelfHeight = 0;
+			}
+			// start a new page if the new shelf does not fit on the current page
+			if (shelfY + paddedHeight > m_maxPageSize)
+			{
+				page++;
+				shelfX = shelfY = shelfHeight = 0;
+			}
+			placements[index] = { page, shelfX + m_padding, shelfY + m_padding };
+			shelfX += paddedWidth;
+			shelfHeight = std::max(shelfHeight, paddedHeight);
+			pageHeight = std::max(pageHeight, shelfY + shelfHeight);
+		}
+
+		PackedTextureImage image;
+		image.width = pageWidth;
+		image.height = (pageHeight + 3) & ~3u;
+		image.layerCount = page + 1;
+		image.pixels.resize(size_t(image.width) * image.height * 4 * image.layerCount, 0);
+
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			blit(textures[i], image, placements[i].page, placements[i].x, placements[i].y, m_padding);
+
+			PackedTextureRegion& region = result.regions[i];
+			region.imageIndex = 0;
+			region.layer = placements[i].page;
+			region.x = placements[i].x;
+			region.y = placements[i].y;
+			region.width = textures[i].width;
+			region.height = textures[i].height;
+			region.uvOffset = { float(region.x) / image.width, float(region.y) / image.height };
+			region.uvScale = { float(region.width) / image.width, float(region.height) / image.height };
+		}
+		result.images.push_back(std::move(image));
+	}
+};
@@ -0,0 +1,375 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+#include "StagingPool.h"
+#include "GpuTimeline.h"
+
+// records uploads (buffer copies, image copies, layout transitions, mip generation) into one command buffer per batch
+// instead of a command buffer, a submit and a queue wait per operation
+//
+//   VkCommandBuffer commandBuffer = uploads.record();   // opens a batch if none is open
+//   ... record copies and barriers ...
+//   uint64_t batch = uploads.submit();                  // one vkQueueSubmit for everything recorded
+//   ... do CPU work ...
+//   uploads.wait(batch);   or   if (uploads.isComplete(batch)) ...
+//
+// batches are submitted through the GPU timeline, the timeline value of a batch tells the staging pool which batch
+// reads which staging memory, it is recycled once the timeline has reached that value
+//
+// copies run on a transfer queue when the device has a transfer only queue family, so they do not compete with
+// frame submission on the graphics queue. Resources then change owner with a release barrier on the transfer queue
+// and an acquire barrier in a second command buffer for the graphics queue, which waits for the transfer submit
+// with a semaphore. The graphics command buffer is also where work the transfer queue cannot do goes (blits, barriers
+// for shader stages). Without a transfer family both are the same command buffer on the graphics queue.
+// Either way the last submit of a batch goes to the graphics queue, which is the queue the timeline belongs to.
+
+struct UploadContextStats {
+	uint64_t batchesSubmitted = 0; // submitted batches (one vkQueueSubmit, two with a separate transfer family)
+	uint64_t recordCalls = 0; // number of record() and recordGraphics() calls, i.e. operations which used to be a submit each
+	uint64_t ownershipTransfers = 0; // resources handed from the transfer to the graphics queue family
+	uint32_t batchCount = 0; // batches (command buffers, semaphore) created so far
+};
+
+class UploadContext {
+public:
+	// pass the graphics family and queue as transfer family and queue if there is no dedicated transfer family
+	void init(VkDevice device, uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily, VkQueue graphicsQueue,
+		StagingPool& stagingPool, GpuTimeline& timeline)
+	{
+		m_device = device;
+		m_timeline = &timeline;
+		m_transferFamily = transferFamily;
+		m_transferQueue = transferQueue;
+		m_graphicsFamily = graphicsFamily;
+		m_graphicsQueue = graphicsQueue;
+		m_stagingPool = &stagingPool;
+		m_separateTransfer = transferFamily != graphicsFamily;
+
+		m_transferPool = createCommandPool(transferFamily);
+		if (m_separateTransfer)
+		{
+			m_graphicsPool = createCommandPool(graphicsFamily);
+		}
+	}
+
+	void destroy()
+	{
+		if (m_open != NO_BATCH)
+		{
+			submit();
+		}
+		wait(m_submitted);
+		for (Batch& batch : m_batches)
+		{
+			if (batch.transferDone != VK_NULL_HANDLE)
+			{
+				vkDestroySemaphore(m_device, batch.transferDone, nullptr);
+			}
+		}
+		m_batches.clear();
+		// frees the command buffers as well
+		vkDestroyCommandPool(m_device, m_transferPool, nullptr);
+		if (m_graphicsPool != VK_NULL_HANDLE)
+		{
+			vkDestroyCommandPool(m_device, m_graphicsPool, nullptr);
+		}
+	}
+
+	// transfer command buffer of the open batch (copies and transfer stage barriers only), a batch is opened if there is none
+	VkCommandBuffer record()
+	{
+		m_stats.recordCalls++;
+		return openBatch().transferCommands;
+	}
+
+	// graphics command buffer of the open batch, it runs after everything recorded with record() in the same batch
+	VkCommandBuffer recordGraphics()
+	{
+		m_stats.recordCalls++;
+		return graphicsCommands(openBatch());
+	}
+
+	// makes the transfer writes to [offset, offset + size) of buffer visible to dstAccess in dstStage on the graphics queue
+	void transferToGraphics(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		Batch& batch = openBatch();
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		if (!m_separateTransfer)
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			return;
+		}
+		barrier.srcQueueFamilyIndex = m_transferFamily;
+		barrier.dstQueueFamilyIndex = m_graphicsFamily;
+		// release: the destination access is ignored by the releasing queue
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 1, &barrier, 0, nullptr);
+		// acquire: the source access is ignored by the acquiring queue, the semaphore wait orders it after the release
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(graphicsCommands(batch), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		m_stats.ownershipTransfers++;
+	}
+
+	// same for an image, the layout changes from oldLayout to newLayout on the way
+	void transferToGraphics(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		Batch& batch = openBatch();
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = image;
+		barrier.subresourceRange = range;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		if (!m_separateTransfer)
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			return;
+		}
+		// release and acquire have to specify the same layouts, the transition happens once
+		barrier.srcQueueFamilyIndex = m_transferFamily;
+		barrier.dstQueueFamilyIndex = m_graphicsFamily;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(graphicsCommands(batch), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		m_stats.ownershipTransfers++;
+	}
+
+	// submits everything recorded since the batch was opened, returns the value of the batch
+	// without an open batch nothing is submitted and the value of the last batch is returned
+	uint64_t submit()
+	{
+		if (m_open == NO_BATCH)
+		{
+			return m_submitted;
+		}
+		Batch& batch = m_batches[m_open];
+		vkEndCommandBuffer(batch.transferCommands);
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &batch.transferCommands;
+		if (!m_separateTransfer)
+		{
+			batch.value = m_timeline->submit(m_graphicsQueue, submitInfo);
+		}
+		else
+		{
+			// the graphics part waits for the transfer part and signals the timeline once both are done,
+			// it is submitted even if nothing was recorded into it
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &batch.transferDone;
+			if (vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit upload batch!");
+			}
+			// the graphics command buffer only holds upload work, so waiting with all of it costs nothing
+			VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			VkSubmitInfo graphicsSubmitInfo{};
+			graphicsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			graphicsSubmitInfo.waitSemaphoreCount = 1;
+			graphicsSubmitInfo.pWaitSemaphores = &batch.transferDone;
+			graphicsSubmitInfo.pWaitDstStageMask = &waitStage;
+			if (batch.graphicsRecording)
+			{
+				vkEndCommandBuffer(batch.graphicsCommands);
+				graphicsSubmitInfo.commandBufferCount = 1;
+				graphicsSubmitInfo.pCommandBuffers = &batch.graphicsCommands;
+				batch.graphicsRecording = false;
+			}
+			batch.value = m_timeline->submit(m_graphicsQueue, graphicsSubmitInfo);
+		}
+		m_submitted = batch.value;
+		batch.inFlight = true;
+		m_open = NO_BATCH;
+		m_stats.batchesSubmitted++;
+		// staging memory written since the last submit is read by this batch
+		m_stagingPool->markSubmitted(batch.value);
+		return batch.value;
+	}
+
+	// non blocking check whether the batch has completed
+	bool isComplete(uint64_t value)
+	{
+		bool complete = m_timeline->isComplete(value);
+		poll();
+		return complete;
+	}
+
+	// blocks until the batch has completed
+	void wait(uint64_t value)
+	{
+		m_timeline->wait(value);
+		poll();
+	}
+
+	// timeline value of the last submitted batch
+	uint64_t submittedValue() const { return m_submitted; }
+	// false if copies run on the graphics queue because the device has no transfer only queue family
+	bool usesTransferQueue() const { return m_separateTransfer; }
+
+	UploadContextStats stats() const
+	{
+		UploadContextStats stats = m_stats;
+		stats.batchCount = static_cast<uint32_t>(m_batches.size());
+		return stats;
+	}
+
+	void printStats(std::ostream& out) const
+	{
+		UploadContextStats current = stats();
+		out << "upload context: " << current.recordCalls << " recorded operations in " << current.batchesSubmitted
+			<< " batches (" << current.batchCount << " in use at once), "
+			<< (m_separateTransfer ? "transfer queue family " + std::to_string(m_transferFamily) : std::string("graphics queue"))
+			<< ", " << current.ownershipTransfers << " ownership transfers\n";
+	}
+
+private:
+	static constexpr uint32_t NO_BATCH = ~0u;
+
+	struct Batch {
+		VkCommandBuffer transferCommands = VK_NULL_HANDLE; // submitted to the transfer queue
+		VkCommandBuffer graphicsCommands = VK_NULL_HANDLE; // submitted to the graphics queue after the transfer commands
+		bool graphicsRecording = false; // graphicsCommands have been begun in this batch
+		VkSemaphore transferDone = VK_NULL_HANDLE; // signaled by the transfer submit, waited for by the graphics submit
+		uint64_t value = 0; // timeline value the batch was submitted as
+		bool inFlight = false;
+	};
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	uint32_t m_transferFamily = 0;
+	VkQueue m_transferQueue = VK_NULL_HANDLE;
+	uint32_t m_graphicsFamily = 0;
+	VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+	bool m_separateTransfer = false; // the transfer queue belongs to a different family than the graphics queue
+	VkCommandPool m_transferPool = VK_NULL_HANDLE;
+	VkCommandPool m_graphicsPool = VK_NULL_HANDLE; // only with a separate transfer family
+	StagingPool* m_stagingPool = nullptr;
+	GpuTimeline* m_timeline = nullptr;
+	std::vector<Batch> m_batches;
+	uint32_t m_open = NO_BATCH; // batch which is being recorded
+	uint64_t m_submitted = 0; // timeline value of the last submitted batch
+	UploadContextStats m_stats;
+
+	// collects finished batches and recycles the staging memory they read
+	void poll()
+	{
+		uint64_t completed = m_timeline->completedValue();
+		for (Batch& batch : m_batches)
+		{
+			// the command buffers are reset implicitly by the next vkBeginCommandBuffer
+			if (batch.inFlight && batch.value <= completed)
+			{
+				batch.inFlight = false;
+			}
+		}
+		m_stagingPool->recycle(completed);
+	}
+
+	VkCommandPool createCommandPool(uint32_t queueFamilyIndex)
+	{
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		// upload command buffers are short lived and re-recorded for every batch
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+		VkCommandPool commandPool;
+		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload command pool!");
+		}
+		return commandPool;
+	}
+
+	static void beginCommands(VkCommandBuffer commandBuffer)
+	{
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	}
+
+	// the batch being recorded, a batch is opened if there is none
+	Batch& openBatch()
+	{
+		if (m_open == NO_BATCH)
+		{
+			m_open = freeBatch();
+			beginCommands(m_batches[m_open].transferCommands);
+		}
+		return m_batches[m_open];
+	}
+
+	// without a separate transfer family everything goes into the transfer command buffer, which runs on the graphics queue
+	VkCommandBuffer graphicsCommands(Batch& batch)
+	{
+		if (!m_separateTransfer)
+		{
+			return batch.transferCommands;
+		}
+		if (!batch.graphicsRecording)
+		{
+			beginCommands(batch.graphicsCommands);
+			batch.graphicsRecording = true;
+		}
+		return batch.graphicsCommands;
+	}
+
+	// a batch whose command buffers can be recorded again, a new one is created if every batch is in flight
+	uint32_t freeBatch()
+	{
+		poll();
+		for (uint32_t i = 0; i < m_batches.size(); i++)
+		{
+			if (!m_batches[i].inFlight)
+			{
+				return i;
+			}
+		}
+
+		Batch batch;
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = m_transferPool;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(m_device, &allocInfo, &batch.transferCommands) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+		if (m_separateTransfer)
+		{
+			allocInfo.commandPool = m_graphicsPool;
+			if (vkAllocateCommandBuffers(m_device, &allocInfo, &batch.graphicsCommands) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate upload command buffer!");
+			}
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &batch.transferDone) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create upload semaphore!");
+			}
+		}
+		m_batches.push_back(batch);
+		return static_cast<uint32_t>(m_batches.size() - 1);
+	}
+};
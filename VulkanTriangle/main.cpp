@@ -11,13 +11,14 @@
 #include <optional>
 #include <set>
 #include <limits> // Necessary for std::numeric_limits
-#include <fstream> // shader files i/o
 #include <glm/glm.hpp> // vec3 and vec2
 #include <array> // std::array
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <chrono>
+#include <thread>
+#include <atomic>
 #define STB_IMAGE_IMPLEMENTATION
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <stb_image.h>
@@ -26,12 +27,52 @@
 #include <unordered_map>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
+#include "TexturePacker.h"
+#include "MemoryAllocator.h"
+#include "FrameRingAllocator.h"
+#include "StagingPool.h"
+#include "UploadContext.h"
+#include "GpuTimeline.h"
+#include "DeferredDeletionQueue.h"
+#include "JobSystem.h"
+#include "SpscQueue.h"
+#include "Profiler.h"
+#include "PipelineCache.h"
+#include "PipelineRegistry.h"
+#include "ShaderReflection.h"
+#include "LayoutCache.h"
+#ifdef ENABLE_SHADER_HOT_RELOAD
+#include "ShaderHotReload.h"
+#endif
+#include "ParallelCommandRecorder.h"
+#include "DynamicRendering.h"
+#include "PipelineLibrary.h"
+#include "EmbeddedShaders.h"
+#include "MappedFile.h"
+#include "SceneConstants.h"
+#include "Benchmarks.h"
 
 const uint32_t WINDOW_WIDTH = 800;
 const uint32_t WINDOW_HEIGHT = 600;
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// threads of the job system (including the main thread), 0 uses every hardware thread
+const uint32_t JOB_THREAD_COUNT = 0;
+// ranges the draw list is cut into when parallel recording is enabled, each one is recorded by a job
+const uint32_t RECORDING_THREAD_COUNT = 4;
+// frame packets the simulation can be ahead of the render thread, with the one being rendered the snapshots are triple buffered
+const size_t FRAME_PACKET_COUNT = 2;
+// bytes of transient data (uniforms, instance data, dynamic vertices) every frame in flight can allocate
+const VkDeviceSize FRAME_RING_SIZE = 1024 * 1024;
 const std::string MODEL_PATH = "models/viking_room.obj";
 const std::string TEXTURE_PATH = "textures/viking_room.png";
+// every texture the scene uses, they are packed into as few images as possible at load time
+// a face samples the one its material names (by file name), faces without one sample the first
+const std::vector<std::string> TEXTURE_PATHS = { TEXTURE_PATH, "textures/texture.jpg" };
+// packed images the fragment shader can sample (the size of its texSampler array)
+const uint32_t MAX_TEXTURE_IMAGES = 4;
+// Atlas packs textures of any size into the layers of one image (uvs are rewritten),
+// SizeClassArray gives every power of two size class its own array image (one layer per texture)
+const TexturePackMode TEXTURE_PACK_MODE = TexturePackMode::Atlas;
 
 // names of validation layers to enable
 const std::vector<const char*> validationLayers = {
@@ -48,6 +89,66 @@ const std::vector<VkDynamicState> dynamicStates = {
 	VK_DYNAMIC_STATE_SCISSOR
 };
 
+// upload many small assets through a staging buffer per asset and through the staging pool at startup and print the throughput
+const bool enableUploadBenchmark = false;
+// record every upload done at startup into one command buffer and submit it once,
+// false submits and waits for every copy, transition and mip generation on its own (the old path)
+const bool enableBatchedUploads = true;
+// run uploads on a transfer only queue family if the device has one,
+// false uses the graphics queue like devices with a single queue family (e.g. lavapipe) do
+const bool enableTransferQueue = true;
+// recreate the swap chain from the old one on resize while in flight frames keep using the old one,
+// false waits for the in flight frames and rebuilds everything (to compare the resize hitch)
+const bool enableIncrementalSwapChainRecreation = true;
+// keep a recorded command buffer per (swap chain image, frame in flight) pair and reuse it until the scene changes,
+// false records the frame's command buffer from scratch every frame
+const bool enableCommandBufferCache = true;
+// record the draw list into secondary command buffers on RECORDING_THREAD_COUNT threads every frame
+// (for scenes which change every frame, the command buffer cache is not used then)
+const bool enableParallelRecording = false;
+// record 10k and 100k draws with 1 to RECORDING_THREAD_COUNT threads at startup and print the record times
+const bool enableRecordingBenchmark = false;
+// measure the job system's spawn overhead and how a CPU only workload scales with its thread count at startup
+const bool enableJobSystemBenchmark = false;
+// draw on a render thread fed with frame packets, the main thread only handles window events and simulates,
+// false polls events and draws one after the other on the main thread
+const bool enableRenderThread = true;
+// decode the textures, parse the model and build the graphics pipeline as jobs while the main thread creates
+// the other Vulkan objects, false runs every startup step one after the other
+const bool enableParallelStartup = true;
+// with ENABLE_STARTUP_PROFILER (Debug builds) the startup profile is also written as a Chrome trace to this file,
+// empty only prints the summary
+const std::string STARTUP_TRACE_PATH = "startup_trace.json";
+// compiled pipelines are kept here between runs
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+// draw the model with an alpha blended pipeline variant, compiled in the background while the default pipeline draws
+const bool enableBlendedVariant = false;
+// draw PERMUTATION_BENCHMARK_FRAMES frames with every shader permutation in BENCHMARK_PERMUTATIONS and print the frame time of each
+const bool enablePermutationBenchmark = false;
+// render without VkRenderPass and VkFramebuffer objects on Vulkan 1.3 devices, the render pass path remains for older ones
+const bool enableDynamicRendering = true;
+// with VK_EXT_graphics_pipeline_library a new pipeline variant is linked from precompiled parts in a fraction of a compile,
+// the optimized pipeline replaces it once it has been compiled in the background; false compiles every variant in one go
+const bool enableGraphicsPipelineLibrary = true;
+// transform vertices with one MVP matrix per object, multiplied on the CPU and pushed with the draw (shader_mvp.vert),
+// false reads model, view and proj from the uniform buffer and multiplies all three for every vertex (shader.vert)
+// off by default: a pushed matrix is part of the recorded commands, so a moving object records them again every frame
+// and the command buffer cache never hits (secondaries do not inherit push constants, they cannot be pushed at submit
+// instead), the uniform buffer is written every frame without touching the recorded commands
+const bool enablePushConstantTransforms = false;
+// draw TRANSFORM_BENCHMARK_FRAMES frames with the uniform buffer transforms, then as many with pushed ones, and print both
+const bool enableTransformBenchmark = false;
+const uint32_t TRANSFORM_BENCHMARK_FRAMES = 300;
+// the uniform buffer of every object (shader.vert) gets its own slot in the frame's constants, minUniformBufferOffsetAlignment
+// apart, and a draw only changes the dynamic offset of the one descriptor set; false gives the frame a single uniform buffer
+const bool enableDynamicUniformBuffer = true;
+// objects the frame's constants have a slot for, longer draw lists wrap around
+const uint32_t MAX_OBJECTS = 256;
+// write and record the constants of many objects with dynamic offsets, a descriptor set per object and push constants
+// at startup and print the CPU time of each (nothing is submitted)
+const bool enableObjectConstantsBenchmark = false;
+const uint32_t PERMUTATION_BENCHMARK_FRAMES = 300;
+
 // enable validation layers only when in debug mode
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -55,29 +156,6 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif //NDEBUG
 
-// input function for reading shader files
-static std::vector<char> readFile(const std::string& filename) {
-	// read the file in binary mode and start at the end of the file
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-	// exception if file is not open
-	if (!file.is_open()) {
-		throw std::runtime_error("failed to open file!");
-	}
-
-	// how many bytes are in the file
-	size_t fileSize = (size_t)file.tellg();
-	// allocate appropriate size of buffer
-	std::vector<char> buffer(fileSize);
-
-	// read the file into the buffer from the beginning
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-	return buffer;
-}
-
 // functions to create and destroy debug messenger
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
 	const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
@@ -105,6 +183,8 @@ struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	// index of family which supports presentation to Windows
 	std::optional<uint32_t> presentationFamily;
+	// index of a family which only supports transfers (optional, uploads go to the graphics queue without it)
+	std::optional<uint32_t> transferFamily;
 	bool isComplete()
 	{
 		return graphicsFamily.has_value() && presentationFamily.has_value();
@@ -122,6 +202,8 @@ struct Vertex {
 	glm::vec3 pos; // position (x, y, z)
 	glm::vec3 color;
 	glm::vec2 texCoords;
+	glm::vec4 texRect{ 0.0f, 0.0f, 1.0f, 1.0f }; // uv offset and uv scale of the vertex's texture inside its packed layer
+	glm::uvec2 texSlot{ 0 }; // packed image and layer of the vertex's texture (loadModel keeps the TEXTURE_PATHS index in x)
 
 	// populating VkVertexInputBindingDescription struct
 	static VkVertexInputBindingDescription getBindingDescription() {
@@ -132,10 +214,10 @@ struct Vertex {
 		return bindingDescription;
 	}
 
-	// returns an array of 2 elements of type VkVertexInputAttributeDescription
-	// one for color and one for position
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+	// returns an array of 5 elements of type VkVertexInputAttributeDescription
+	// position, color, texture coordinates and where the texture was packed
+	static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions{};
 
 		// POSITION ATTRIBUTE
 		attributeDescriptions[0].binding = 0; // index of the binding in the array of bindings
@@ -155,11 +237,22 @@ struct Vertex {
 		attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
 		attributeDescriptions[2].offset = offsetof(Vertex, texCoords);
 
+		// PACKED TEXTURE ATTRIBUTES
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(Vertex, texRect);
+
+		attributeDescriptions[4].binding = 0;
+		attributeDescriptions[4].location = 4;
+		attributeDescriptions[4].format = VK_FORMAT_R32G32_UINT;
+		attributeDescriptions[4].offset = offsetof(Vertex, texSlot);
+
 		return attributeDescriptions;
 	}
 	bool operator == (const Vertex& other) const
 	{
-		return pos == other.pos && color == other.color && texCoords == other.texCoords;
+		return pos == other.pos && color == other.color && texCoords == other.texCoords && texRect == other.texRect && texSlot == other.texSlot;
 	}
 };
 
@@ -168,17 +261,56 @@ namespace std {
 		size_t operator()(Vertex const& vertex) const {
 			return ((hash<glm::vec3>()(vertex.pos) ^
 				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoords) << 1);
+				(hash<glm::vec2>()(vertex.texCoords) << 1) ^
+				(hash<glm::uvec2>()(vertex.texSlot) << 2);
 		}
 	};
 }
 
-struct UniformBufferObject {
-	alignas(16) glm::mat4 model;
-	alignas(16) glm::mat4 view;
-	alignas(16) glm::mat4 proj;
+// snapshot of everything the render thread needs from the simulation to draw one frame
+// copied by value, so the simulation can go on with the next frame while this one is rendered
+struct FramePacket {
+	uint64_t frameNumber = 0;
+	glm::mat4 model{ 1.0f }; // transform of the model
+	glm::mat4 view{ 1.0f }; // camera
 };
 
+// fragment shader work a material can switch off, every combination is a pipeline of its own
+// (specialization constants of shader.frag, the driver removes the work of features which are off)
+enum ShaderFeature : uint32_t {
+	ShaderFeatureVertexColor = 1 << 0, // multiply by the interpolated vertex color
+	ShaderFeatureTexture = 1 << 1, // sample texSampler
+	ShaderFeatureAlphaTest = 1 << 2, // discard fragments whose texture alpha is below 0.5
+};
+
+struct ShaderPermutation {
+	uint32_t features = ShaderFeatureVertexColor | ShaderFeatureTexture; // ShaderFeature bits
+	uint32_t textureSamples = 1; // texture taps averaged per fragment
+	const char* name = "default";
+};
+
+// loadModel() writes white vertex colors, multiplying by them is wasted work
+const ShaderPermutation SCENE_PERMUTATION = { ShaderFeatureTexture, 1, "texture" };
+const ShaderPermutation BENCHMARK_PERMUTATIONS[] = {
+	{ ShaderFeatureVertexColor | ShaderFeatureTexture, 1, "vertex color + texture" },
+	{ ShaderFeatureTexture, 1, "texture" },
+	{ ShaderFeatureVertexColor, 1, "vertex color" },
+	{ ShaderFeatureTexture | ShaderFeatureAlphaTest, 1, "texture + alpha test" },
+	{ ShaderFeatureTexture, 4, "texture, 4 samples" },
+	{ ShaderFeatureTexture, 16, "texture, 16 samples" },
+};
+
+// the specialization constants shader.frag reads the permutation from
+static std::vector<SpecializationConstant> specializationConstants(const ShaderPermutation& permutation)
+{
+	return {
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, 0, (permutation.features & ShaderFeatureVertexColor) ? 1u : 0u }, // USE_VERTEX_COLOR
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, 1, (permutation.features & ShaderFeatureTexture) ? 1u : 0u }, // USE_TEXTURE
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, 2, (permutation.features & ShaderFeatureAlphaTest) ? 1u : 0u }, // ALPHA_TEST
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, 3, permutation.textureSamples }, // TEXTURE_SAMPLES
+	};
+}
+
 // vertex information
 //const std::vector<Vertex> vertices = {
 //
@@ -210,6 +342,14 @@ public:
 		initWindow();
 		// everything related to vulkan is initialized
 		initVulkan();
+#ifdef ENABLE_STARTUP_PROFILER
+		// resizes later on are not part of startup
+		Profiler::stop();
+		Profiler::printSummary(std::cout);
+		if (!STARTUP_TRACE_PATH.empty() && Profiler::writeChromeTrace(STARTUP_TRACE_PATH)) {
+			std::cout << "startup trace written to " << STARTUP_TRACE_PATH << "\n";
+		}
+#endif
 		// game loop
 		mainLoop();
 		// everything is closed/destroyed/freed
@@ -232,6 +372,8 @@ private:
 	VkDevice m_device;
 	// a handle to the graphics queue from our logical device
 	VkQueue graphicsQueue;
+	// a handle to the queue uploads run on (the graphics queue if there is no transfer only queue family)
+	VkQueue m_transferQueue;
 	// a handle to vulkan surface
 	VkSurfaceKHR m_surface;
 	// a handle to the presentation queue from our logical device
@@ -245,12 +387,26 @@ private:
 	VkExtent2D m_swapChainExtent;
 	// image views for the swap chain images
 	std::vector<VkImageView> m_swapChainImageViews;
+	// size the multisampled color and depth images were allocated with, they only grow (can be bigger than the swap chain)
+	VkExtent2D m_renderTargetExtent{ 0, 0 };
+	VkFormat m_renderTargetFormat = VK_FORMAT_UNDEFINED; // swap chain format the multisampled color image was created with
+	// how long recreateSwapChain() blocked the render loop
+	uint32_t m_swapChainRecreations = 0;
+	double m_resizeHitchTotalMilliseconds = 0.0;
+	double m_resizeHitchWorstMilliseconds = 0.0;
 	// handle to render pass object
-	VkRenderPass m_renderPass;
+	VkRenderPass m_renderPass = VK_NULL_HANDLE; // stays VK_NULL_HANDLE with dynamic rendering
+	// begins rendering directly on the image views (Vulkan 1.3), m_dynamicRendering says whether the device got it
+	DynamicRendering m_dynamicRenderer;
+	bool m_dynamicRendering = false;
 	// handle to the descriptor set layout
 	VkDescriptorSetLayout m_descriptorSetLayout;
 	// handle to uniform values
 	VkPipelineLayout m_pipelineLayout;
+	// what shader.vert, shader_mvp.vert and shader.frag declare together (bindings, push constants, vertex inputs), read from their SPIR-V
+	ShaderReflection m_shaderInterface;
+	// every descriptor set and pipeline layout, shared by all shaders which declare the same interface
+	LayoutCache m_layouts;
 	// final graphics pipeline
 	VkPipeline m_graphicsPipeline;
 	// handle to the framebuffers for each swap chain image
@@ -260,6 +416,42 @@ private:
 	// handle to the command buffer
 	//VkCommandBuffer m_commandBuffer;
 	std::vector<VkCommandBuffer> m_commandBuffers;
+	// a command buffer recorded for one (swap chain image, frame in flight) pair
+	struct CachedCommandBuffer {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint64_t recordedGeneration = 0; // scene generation it was recorded for (0 = never recorded)
+	};
+	std::vector<CachedCommandBuffer> m_cachedCommandBuffers; // index: imageIndex * MAX_FRAMES_IN_FLIGHT + frame
+	uint64_t m_sceneGeneration = 1; // bumped whenever recorded commands go stale (resize, scene or pipeline change)
+	// work stealing scheduler everything which runs on several cores goes through
+	JobSystem m_jobs;
+	// records the draw list into secondary command buffers on several threads
+	ParallelCommandRecorder m_parallelRecorder;
+	uint32_t m_drawCount = 1; // draws in the scene's draw list (the whole model is one draw)
+	// CPU time spent recording command buffers
+	uint64_t m_recordedFrames = 0;
+	uint64_t m_commandBufferRecordings = 0;
+	double m_recordTotalMicroseconds = 0.0;
+	// CPU time spent updating the transforms (uniform buffer copy or MVP multiply)
+	uint64_t m_updatedFrames = 0;
+	double m_updateTotalMicroseconds = 0.0;
+	uint64_t m_transformInvalidations = 0; // frames whose pushed MVP changed, which made the recorded commands stale
+	// main thread -> render thread
+	SpscQueue<FramePacket, FRAME_PACKET_COUNT> m_framePackets;
+	std::thread m_renderThread;
+	std::atomic<bool> m_renderThreadQuit{ false }; // set by the main thread when the window closes
+	std::atomic<bool> m_renderThreadDone{ false }; // set by the render thread when it stops (early if drawing threw)
+	std::exception_ptr m_renderThreadError; // read by the main thread after joining
+	// glfw can only be asked on the main thread, the render thread uses the framebuffer size the main thread saw last
+	std::atomic<int> m_framebufferWidth{ 0 };
+	std::atomic<int> m_framebufferHeight{ 0 };
+	// CPU frame time of both threads
+	uint64_t m_simulatedFrames = 0;
+	double m_simulationTotalMicroseconds = 0.0;
+	uint64_t m_drawnFrames = 0;
+	double m_drawTotalMicroseconds = 0.0;
+	// time to first frame is measured from the start of initVulkan
+	std::chrono::high_resolution_clock::time_point m_startupBegin;
 	///////////////////////////
 	// semaphores and fences //
 	///////////////////////////
@@ -267,12 +459,40 @@ private:
 	//VkSemaphore m_renderFinishedSemaphore; // rendering has finished and presentation can happen
 	//VkFence m_inFlightFence; // fence to syncronize the cpu and gpu
 
-	std::vector<VkFence> m_inFlightFences; // fences for each frame in flight
+	// every submit signals the next value of the GPU timeline, "has this work finished" is a comparison against its completed value
+	GpuTimeline m_timeline;
+	// pipelines are created through it, so the driver does not compile them again on the next launch
+	PersistentPipelineCache m_pipelineCache;
+	// every graphics pipeline variant, compiled in the background the first time it is asked for
+	PipelineRegistry m_pipelines;
+	// the parts the variants are linked from, m_graphicsPipelineLibrary says whether the device has the extension
+	GraphicsPipelineLibrary m_pipelineLibrary;
+	bool m_graphicsPipelineLibrary = false;
+	GraphicsPipelineDesc m_defaultPipelineDesc; // m_graphicsPipeline's description
+	GraphicsPipelineDesc m_scenePipelineDesc; // what the scene wants to be drawn with
+	FrameBenchmark m_permutationBenchmark; // enablePermutationBenchmark
+	FrameBenchmark m_transformBenchmark; // enableTransformBenchmark
+	VkPipeline m_boundPipeline = VK_NULL_HANDLE; // what the recorded command buffers bind (the default pipeline until the variant is ready)
+	// m_boundPipeline's vertex shader takes the MVP as a push constant, recordDraws pushes m_objectTransform with the draws
+	bool m_pushTransforms = false;
+	ObjectTransform m_objectTransform;
+	// bytes between the uniform buffers of two objects in the frame's constants (sizeof(UniformBufferObject) aligned up)
+	VkDeviceSize m_objectConstantsStride = sizeof(UniformBufferObject);
+#ifdef ENABLE_SHADER_HOT_RELOAD
+	// shaders/shader.vert and shader.frag are compiled again whenever they are saved, the pipelines follow at a frame boundary
+	ShaderHotReload m_shaderHotReload;
+	uint64_t m_framesAtShaderSwap = 0; // frames drawn when the current shaders were swapped in
+	double m_drawMicrosecondsAtShaderSwap = 0.0;
+	std::chrono::high_resolution_clock::time_point m_shaderSwapTime = std::chrono::high_resolution_clock::now();
+#endif
+	GpuTimelineSupport m_timelineSupport = GpuTimelineSupport::None; // timeline semaphores if the device has them, fences otherwise
+	uint32_t m_instanceApiVersion = VK_API_VERSION_1_0; // Vulkan version the instance was created with
+	std::vector<uint64_t> m_frameTimelineValues; // timeline value of the last submission of each frame in flight
 	std::vector<VkSemaphore> m_imageAvailableSemaphores; // semaphores for each frame in flight
 	std::vector<VkSemaphore> m_renderFinishedSemaphores; // semaphores for each frame in flight
 
-	// flag to check if the window has been resized
-	bool framebufferResized = false;
+	// flag to check if the window has been resized (set on the main thread, read on the render thread)
+	std::atomic<bool> framebufferResized{ false };
 
 	// list of vertices
 	std::vector<Vertex> m_vertices;
@@ -284,43 +504,56 @@ private:
 	// handle to store the vertex buffer
 	VkBuffer m_vertexBuffer;
 	// handle to store the memory for the vertex buffer
-	VkDeviceMemory m_vertexBufferMemory;
+	MemoryAllocation m_vertexBufferMemory;
 	// handle to store the index buffer
 	VkBuffer m_indexBuffer;
 	// handle to store the memory for the index buffer
-	VkDeviceMemory m_indexBufferMemory;
-	// uniform buffer for every frame in flight
-	std::vector<VkBuffer> m_uniformBuffers;
-	// memory for the uniform buffer for every frame in flight
-	std::vector<VkDeviceMemory> m_uniformBuffersMemory;
-	// mapped memory for the uniform buffer for every frame in flight
-	std::vector<void*> m_uniformBuffersData; // pointer to the mapped memory for the uniform buffer for every frame in flight
+	MemoryAllocation m_indexBufferMemory;
+	// per frame transient data, the uniform buffer object of every frame in flight sits at the start of its region
+	FrameRingAllocator m_frameAllocator;
 	VkDescriptorPool m_descriptorPool; // pool of memory for descriptors
 	std::vector<VkDescriptorSet> m_descriptorSets;
 
 	// texturing
-	VkImage m_textureImage; // handle for the image
-	VkDeviceMemory m_textureImageMemory; // memory for the texture image
-	VkImageView m_textureImageView; // image view for the texture image
-	VkSampler m_textureSampler; // sampler for the texture image
+	// a packed texture image and everything made for it
+	struct TextureImage {
+		VkImage image; // handle for the image
+		MemoryAllocation memory; // memory for the texture image
+		VkImageView view; // 2D array view over every layer
+		uint32_t mipLevels; // number of mip levels possible
+		uint32_t layerCount; // number of array layers in the texture image
+	};
+	std::vector<TextureImage> m_textureImages; // one per image the texture packer made
+	VkSampler m_textureSampler; // sampler for every texture image
+	std::vector<PackedTextureRegion> m_textureRegions; // where every entry of TEXTURE_PATHS ended up in the texture images
+	TexturePackResult m_packedTextures; // decoded and packed by decodeTextures(), released once uploaded
 
 	// depth buffering
 	VkImage m_depthImage; // handle for the image
-	VkDeviceMemory m_depthImageMemory; // memory for the depth image
+	MemoryAllocation m_depthImageMemory; // memory for the depth image
 	VkImageView m_depthImageView; // image view for the depth image
 
 	// mipmapping
-	uint32_t m_mipLevels; // number of mip levels possible
 	VkImage m_colorImage;
-	VkDeviceMemory m_colorImageMemory;
+	MemoryAllocation m_colorImageMemory;
 	VkImageView m_colorImageView;
 
 	// multisampling
 	VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT; // number of samples to use for multisampling
 
+	// places buffers and images inside large blocks of device memory
+	DeviceMemoryAllocator m_allocator;
+	// objects which are destroyed once the GPU timeline has passed their last use
+	DeferredDeletionQueue m_deletionQueue;
+
+	// uploads
+	StagingPool m_stagingPool; // persistently mapped staging memory, recycled once the copies out of it completed
+	UploadContext m_uploads; // records uploads into batches, one submit per batch
+
 
 	void initWindow()
 	{
+		PROFILE_SCOPE("initWindow");
 		// initialize glfw library
 		glfwInit();
 
@@ -332,10 +565,32 @@ private:
 		m_window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Vulkan", nullptr, nullptr);
 		glfwSetWindowUserPointer(m_window, this);
 		glfwSetFramebufferSizeCallback(m_window, framebufferResizeCallback);
+		updateFramebufferSize();
+	}
+
+	// main thread only
+	void updateFramebufferSize() {
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(m_window, &width, &height);
+		m_framebufferWidth = width;
+		m_framebufferHeight = height;
+	}
+
+	// safe on the render thread
+	void framebufferSize(int& width, int& height) {
+		if (enableRenderThread) {
+			width = m_framebufferWidth;
+			height = m_framebufferHeight;
+		}
+		else {
+			glfwGetFramebufferSize(m_window, &width, &height);
+		}
 	}
 
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
 		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->m_framebufferWidth = width;
+		app->m_framebufferHeight = height;
 		app->framebufferResized = true;
 
 		// Commenting the below code will reproduce the problem
@@ -354,6 +609,11 @@ private:
 	// initialize vulkan related stuff
 	void initVulkan()
 	{
+		PROFILE_SCOPE("initVulkan");
+		m_startupBegin = std::chrono::high_resolution_clock::now();
+		auto startupBegin = m_startupBegin;
+		// worker threads for everything which runs in parallel
+		m_jobs.init(JOB_THREAD_COUNT);
 		// create a vulkan instance
 		createInstance();
 		// create a debug "thing"
@@ -364,17 +624,32 @@ private:
 		pickPhysicalDevice();
 		// create a logical version of the selected physical gpu/device we have selected
 		createLogicalDevice();
+		// reserve device memory in blocks instead of once per resource
+		m_allocator.init(physicalDevice, m_device);
+		m_deletionQueue.init(m_device, m_allocator);
 		// create a swap chain with desiered properties for our vulkan instance
-		createSwapChain();
+		createSwapChain(VK_NULL_HANDLE);
 		// create image views for the swap chain images
 		createImageViews();
 		// create a render pass object
 		createRenderPass();
 		// create descriptor set layout
 		createDescriptorSetLayout();
+
+		// startup graph: the steps below only need what has been created so far, so they run as jobs while the main thread
+		// goes on, every counter is an edge to the step which needs the result (the waits further down)
+		//   decodeTextures         -> createTextureImage
+		//   loadModel              -> remapModelTexCoords (also after decodeTextures) -> createVertexBuffer, createIndexBuffer
+		//   createGraphicsPipeline -> end of startup (first recorded frame)
+		// Vulkan object creation is thread safe, everything which records commands or allocates memory stays on the main thread
+		JobCounter texturesDecoded, modelLoaded, pipelineCreated;
+		startupStep(texturesDecoded, [this]() { decodeTextures(); });
+		startupStep(modelLoaded, [this]() { loadModel(); });
 		// create graphics pipeline
-		createGraphicsPipeline();
+		startupStep(pipelineCreated, [this]() { createGraphicsPipeline(); });
+
 		// set up multisampling
+		m_renderTargetExtent = m_swapChainExtent;
 		createColorReasources();
 		// create depth resources
 		createDepthResources();
@@ -382,18 +657,34 @@ private:
 		createFramebuffers();
 		// create command pool to manage memory for future command buffers
 		createCommandPool();
+		// create the staging pool and what is needed to track uploads
+		createUploadResources();
 		// create texture image
+		{
+			PROFILE_SCOPE("wait for decodeTextures");
+			m_jobs.wait(texturesDecoded);
+		}
 		createTextureImage();
 		// create texture image view
 		createTextureImageView();
 		// create texture sampler
 		createTextureSampler();
 		// load model
-		loadModel();
+		{
+			PROFILE_SCOPE("wait for loadModel");
+			m_jobs.wait(modelLoaded);
+		}
+		remapModelTexCoords();
 		// create vertex buffer
 		createVertexBuffer();
 		// create index buffer
 		createIndexBuffer();
+		// submit everything recorded by the uploads above at once, the GPU works on it while the rest is created
+		uint64_t startupUploads;
+		{
+			PROFILE_SCOPE("submit uploads");
+			startupUploads = m_uploads.submit();
+		}
 		// create uniform buffers
 		createUniformBuffers();
 		// create descriptor pools
@@ -404,23 +695,168 @@ private:
 		createCommandBuffers();
 		// creating semaphores and fences
 		createSyncObjects();
+		// the first frame needs the pipeline
+		{
+			PROFILE_SCOPE("wait for createGraphicsPipeline");
+			m_jobs.wait(pipelineCreated);
+		}
+		// keep what startup compiled even if the application does not shut down cleanly
+		m_pipelineCache.save();
+		// the first frame samples the texture and reads the vertex/index buffers
+		{
+			PROFILE_SCOPE("wait for uploads");
+			m_uploads.wait(startupUploads);
+		}
+		double startupMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupBegin).count();
+		std::cout << "startup: " << startupMilliseconds << " ms with " << (enableBatchedUploads ? "batched uploads" : "a submission per upload")
+			<< " (" << m_uploads.stats().batchesSubmitted << " upload submissions), " << (enableParallelStartup ? "parallel" : "serial")
+			<< " startup steps\n";
+		MappedFile::printStats(std::cout);
+		std::cout << "shaders: " << embeddedShaderBytes() / 1024 << " KiB of SPIR-V embedded, no shader files read\n";
+		if (enableUploadBenchmark) {
+			benchmarkUploads(benchmarkRenderer());
+		}
+		if (enableRecordingBenchmark) {
+			benchmarkRecording(benchmarkRenderer(), RECORDING_THREAD_COUNT);
+		}
+		if (enableObjectConstantsBenchmark) {
+			benchmarkObjectConstants(benchmarkRenderer());
+		}
+		if (enableJobSystemBenchmark) {
+			benchmarkJobSystem();
+		}
+		// lavapipe shades on the CPU, so with the model filling the window the permutations mostly differ in fragment cost
+		if (enablePermutationBenchmark) {
+			std::vector<FrameBenchmark::Variant> variants;
+			for (const ShaderPermutation& permutation : BENCHMARK_PERMUTATIONS) {
+				variants.push_back({ permutation.name, [permutation](GraphicsPipelineDesc& desc) {
+					desc.specialization = specializationConstants(permutation);
+					} });
+			}
+			m_permutationBenchmark.init("permutation benchmark", PERMUTATION_BENCHMARK_FRAMES, std::move(variants),
+				[](GraphicsPipelineDesc& desc) { desc.specialization = specializationConstants(SCENE_PERMUTATION); });
+		}
+		// lavapipe runs the vertex shader on the CPU as well, so the per vertex multiplies of shader.vert show up in the frame
+		// time, the CPU time spent updating the transforms and recording shows what pushing them costs
+		if (enableTransformBenchmark) {
+			m_transformBenchmark.init("transform benchmark", TRANSFORM_BENCHMARK_FRAMES, {
+				{ "uniform buffer", [](GraphicsPipelineDesc& desc) { desc.vertexShader = "shaders/vert.spv"; } },
+				{ "push constants", [](GraphicsPipelineDesc& desc) { desc.vertexShader = "shaders/mvp_vert.spv"; } },
+				}, [this](GraphicsPipelineDesc& desc) { desc.vertexShader = m_defaultPipelineDesc.vertexShader; }, true);
+		}
+		// how the device memory ended up being used
+		m_allocator.printStats(std::cout);
+	}
+
+	// runs step as a job counted by counter with parallel startup, right away otherwise
+	void startupStep(JobCounter& counter, JobSystem::Job step)
+	{
+		if (enableParallelStartup) {
+			m_jobs.run(std::move(step), &counter);
+		}
+		else {
+			step();
+		}
 	}
 
 	void mainLoop()
 	{
-		while (!glfwWindowShouldClose(m_window))
-		{
-			glfwPollEvents();
-			drawFrame();
+		auto loopBegin = std::chrono::high_resolution_clock::now();
+		if (enableRenderThread) {
+			// the render thread draws what the main thread simulated, so a slow present or wait never holds up the events
+			m_renderThread = std::thread(&HelloTriangleApplication::renderLoop, this);
+			while (!glfwWindowShouldClose(m_window) && !m_renderThreadDone)
+			{
+				glfwPollEvents();
+				updateFramebufferSize();
+				FramePacket packet = simulateFrame();
+				// the render thread is FRAME_PACKET_COUNT frames behind, keep handling events until it takes the next packet
+				while (!m_framePackets.tryPush(packet) && !m_renderThreadDone && !glfwWindowShouldClose(m_window))
+				{
+					glfwWaitEventsTimeout(0.001);
+					updateFramebufferSize();
+				}
+			}
+			m_renderThreadQuit = true;
+			m_framePackets.wake();
+			m_renderThread.join();
+			if (m_renderThreadError) {
+				vkDeviceWaitIdle(m_device);
+				std::rethrow_exception(m_renderThreadError);
+			}
+		}
+		else {
+			while (!glfwWindowShouldClose(m_window))
+			{
+				glfwPollEvents();
+				renderFrame(simulateFrame());
+			}
+		}
+		double loopSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loopBegin).count();
+		if (m_drawnFrames > 0) {
+			std::cout << "frame loop (render thread " << (enableRenderThread ? "on" : "off") << "): " << m_drawnFrames << " frames in "
+				<< loopSeconds << " s (" << m_drawnFrames / loopSeconds << " fps), CPU time per frame: simulation "
+				<< m_simulationTotalMicroseconds / m_simulatedFrames / 1000.0 << " ms, draw " << m_drawTotalMicroseconds / m_drawnFrames / 1000.0 << " ms\n";
 		}
 		// wait for the device to finish all operations before exiting
 		vkDeviceWaitIdle(m_device);
 	}
+
+	// runs on the render thread, draws the packets the main thread pushes until it is told to quit
+	void renderLoop()
+	{
+		try {
+			FramePacket packet;
+			while (!m_renderThreadQuit)
+			{
+				// sleeps while the simulation is behind (or the window is being dragged around), the main thread's push
+				// or its wake() on quit ends the wait
+				if (m_framePackets.waitPop(packet)) {
+					renderFrame(packet);
+				}
+			}
+		}
+		catch (...) {
+			m_renderThreadError = std::current_exception();
+		}
+		m_renderThreadDone = true;
+	}
+
+	// advances the scene and takes the snapshot the frame is drawn from
+	FramePacket simulateFrame()
+	{
+		auto simulationBegin = std::chrono::high_resolution_clock::now();
+		// update happen independent of frame rate
+		static auto startTime = std::chrono::high_resolution_clock::now();
+		float timeElapsed = std::chrono::duration<float, std::chrono::seconds::period>(simulationBegin - startTime).count();
+
+		FramePacket packet;
+		packet.frameNumber = m_simulatedFrames++;
+		packet.model = glm::rotate(glm::mat4(1.0f), timeElapsed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)); // rotate 90 degrees per second around z axis
+		packet.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), // camera position
+			glm::vec3(0.0f, 0.0f, 0.0f), // look at origin
+			glm::vec3(0.0f, 0.0f, 1.0f)); // up vector
+		m_simulationTotalMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - simulationBegin).count();
+		return packet;
+	}
+
+	void renderFrame(const FramePacket& packet)
+	{
+		auto drawBegin = std::chrono::high_resolution_clock::now();
+		drawFrame(packet);
+		auto drawEnd = std::chrono::high_resolution_clock::now();
+		m_drawTotalMicroseconds += std::chrono::duration<double, std::micro>(drawEnd - drawBegin).count();
+		if (m_drawnFrames++ == 0) {
+			std::cout << "time to first frame: " << std::chrono::duration<double, std::milli>(drawEnd - m_startupBegin).count() << " ms ("
+				<< (enableParallelStartup ? "parallel" : "serial") << " startup)\n";
+		}
+	}
 	/////////////////////////////
 	// create a vulkan instance
 	/////////////////////////////
 	void createInstance()
 	{
+		PROFILE_SCOPE("createInstance");
 		//////////////////////////////////////
 		//              APPLICATION INFO
 		//////////////////////////////////////
@@ -431,7 +867,16 @@ private:
 		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0); // version of the application (developer supplied)
 		appInfo.pEngineName = "No Engine"; // name of the engine used to create the application
 		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0); // version of the engine used to create the application
-		appInfo.apiVersion = VK_API_VERSION_1_0; // must be the highest version of Vulkan that the application is designed to use
+		// must be the highest version of Vulkan that the application is designed to use
+		// 1.3 for dynamic rendering and 1.2 for timeline semaphores if the loader knows them,
+		// a Vulkan 1.0 loader does not even have vkEnumerateInstanceVersion
+		auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+		uint32_t loaderVersion = VK_API_VERSION_1_0;
+		if (enumerateInstanceVersion != nullptr) {
+			enumerateInstanceVersion(&loaderVersion);
+		}
+		m_instanceApiVersion = std::min(loaderVersion, VK_API_VERSION_1_3);
+		appInfo.apiVersion = m_instanceApiVersion;
 
 		// struct to tell the Vulkan driver which global EXTENSIONS and validation LAYERS we want to use
 		VkInstanceCreateInfo createInfo{};
@@ -452,9 +897,12 @@ private:
 		std::vector<VkExtensionProperties> extensions(extensionCount);
 		// Each VkExtensionProperties struct contains the name and version of an extension.
 		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-		std::cout << "\navailable extensions:\n";
-		for (const VkExtensionProperties& extension : extensions) {
-			std::cout << '\t' << extension.extensionName << '\n';
+		// only listed while debugging, printing them is a noticeable part of startup
+		if (enableValidationLayers) {
+			std::cout << "\navailable extensions:\n";
+			for (const VkExtensionProperties& extension : extensions) {
+				std::cout << '\t' << extension.extensionName << '\n';
+			}
 		}
 		if (!checkRequiredExtentionPresent(extensions, glfwExtensions, glfwExtensions.size()))
 		{
@@ -603,6 +1051,7 @@ private:
 	/////////////////////////////////////
 	void setupDebugMessenger()
 	{
+		PROFILE_SCOPE("setupDebugMessenger");
 		// function is not in use if validation layers are not enabled
 		if (!enableValidationLayers) return;
 
@@ -620,6 +1069,7 @@ private:
 	/////////////////////////////////////
 	void createSurface()
 	{
+		PROFILE_SCOPE("createSurface");
 		// creates a surface for us, specifically made for windows machine
 		// needs: instance to create the surface IN, window to create the surface FOR
 		// returns handle to the surface
@@ -631,6 +1081,7 @@ private:
 	// PHYSICAL DEVICE (Search, Select, Suitability, Compatability)
 	/////////////////////////////////////
 	void pickPhysicalDevice() {
+		PROFILE_SCOPE("pickPhysicalDevice");
 		// how many physical devices/GPUs we have on the system
 		uint32_t deviceCount = 0;
 		vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
@@ -740,6 +1191,21 @@ private:
 			}
 			i++;
 		}
+
+		// a family with transfer but without graphics and compute support is usually backed by the copy engines
+		// image copies copy row ranges, so the family has to allow copies at any texel offset
+		for (uint32_t family = 0; enableTransferQueue && family < queueFamilyCount; family++)
+		{
+			const VkQueueFamilyProperties& properties = queueFamilies[family];
+			bool transferOnly = (properties.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+				!(properties.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+			VkExtent3D granularity = properties.minImageTransferGranularity;
+			if (transferOnly && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+			{
+				indices.transferFamily = family;
+				break;
+			}
+		}
 		return indices;
 	}
 
@@ -748,7 +1214,9 @@ private:
 	/////////////////////////////////////
 
 	// create swap chain
-	void createSwapChain() {
+	// oldSwapChain is the swap chain being replaced (VK_NULL_HANDLE if there is none), it stays valid for the frames still using it
+	void createSwapChain(VkSwapchainKHR oldSwapChain) {
+		PROFILE_SCOPE("createSwapChain");
 		// what is being supported by our physical device
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 		// best possible settings for our swap chain
@@ -796,7 +1264,8 @@ private:
 
 		// topics to be learned later
 		createInfo.clipped = VK_TRUE;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+		// lets the driver hand resources over from the old swap chain, the old one is retired (no more acquires) but not destroyed
+		createInfo.oldSwapchain = oldSwapChain;
 
 		// creation!!
 		if (vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain) != VK_SUCCESS) {
@@ -875,7 +1344,7 @@ private:
 		else
 		{
 			int width, height;
-			glfwGetFramebufferSize(m_window, &width, &height);
+			framebufferSize(width, height);
 
 			VkExtent2D actualExtent = {
 				static_cast<uint32_t>(width),
@@ -890,15 +1359,21 @@ private:
 		}
 	}
 	void createImageViews() {
+		PROFILE_SCOPE("createImageViews");
 		m_swapChainImageViews.resize(m_swapChainImages.size());
 
 		// iterate over every swap chain image
 		for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-			m_swapChainImageViews[i] = createImageView(m_swapChainImages[i], m_swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+			m_swapChainImageViews[i] = createImageView(m_swapChainImages[i], m_swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
 		}
 	}
 	void createRenderPass()
 	{
+		PROFILE_SCOPE("createRenderPass");
+		// dynamic rendering describes the attachments when it begins, there is nothing to create
+		if (m_dynamicRendering) {
+			return;
+		}
 		// attaching depth attachment
 		VkAttachmentDescription depthAttachment{};
 		depthAttachment.format = findDepthFormat();
@@ -977,45 +1452,111 @@ private:
 			throw std::runtime_error("failed to create render pass!");
 		}
 	}
-	// how are the descriptors going to be layed out (binding no, total count etc.)
+	// how are the descriptors going to be layed out (binding no, type, count, stages), read from what the shaders declare
+	// the pipeline layout comes with it, so whatever binds descriptor sets can do so before the pipeline is compiled
 	void createDescriptorSetLayout()
 	{
-		VkDescriptorSetLayoutBinding uboLayoutBinding{};
-		uboLayoutBinding.binding = 0; // binding = 0 in the shader
-		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // type of descriptor
-		uboLayoutBinding.descriptorCount = 1; // number of values in the array of descriptors
-		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // shader stage to bind to
-		uboLayoutBinding.pImmutableSamplers = nullptr; // only relevant for image sampling
-
-		VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-		samplerLayoutBinding.binding = 1;
-		samplerLayoutBinding.descriptorCount = 1;
-		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		samplerLayoutBinding.pImmutableSamplers = nullptr;
-		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-		//std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
-
-		std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
-		VkDescriptorSetLayoutCreateInfo layoutInfo{};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-		layoutInfo.pBindings = bindings.data();
-
-		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create descriptor set layout!");
+		PROFILE_SCOPE("createDescriptorSetLayout");
+		SpirvCode vertShaderCode = embeddedShader("shaders/vert.spv");
+		SpirvCode mvpVertShaderCode = embeddedShader("shaders/mvp_vert.spv");
+		SpirvCode fragShaderCode = embeddedShader("shaders/frag.spv");
+		m_shaderInterface = reflectShader(vertShaderCode.words, vertShaderCode.wordCount, VK_SHADER_STAGE_VERTEX_BIT);
+		// both vertex shaders share one layout (the uniform buffer and the push constant range), so switching between them
+		// keeps the descriptor sets
+		m_shaderInterface.merge(reflectShader(mvpVertShaderCode.words, mvpVertShaderCode.wordCount, VK_SHADER_STAGE_VERTEX_BIT));
+		m_shaderInterface.merge(reflectShader(fragShaderCode.words, fragShaderCode.wordCount, VK_SHADER_STAGE_FRAGMENT_BIT));
+		if (enableDynamicUniformBuffer && !m_shaderInterface.makeDynamic("ubo")) {
+			throw std::runtime_error("failed to create descriptor set layout, the shaders have no ubo to bind dynamically!");
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts;
+		m_pipelineLayout = m_layouts.pipelineLayout(m_shaderInterface, setLayouts);
+		// one descriptor set per frame is all the renderer binds
+		if (setLayouts.size() != 1) {
+			throw std::runtime_error("failed to create descriptor set layout, the shaders have to use set 0 only!");
+		}
+		m_descriptorSetLayout = setLayouts[0];
+	}
+	// compiles the default pipeline, which is also the fallback for variants still being compiled
+	void createGraphicsPipeline()
+	{
+		PROFILE_SCOPE("createGraphicsPipeline");
+		GraphicsPipelineDesc desc;
+		desc.vertexShader = enablePushConstantTransforms ? "shaders/mvp_vert.spv" : "shaders/vert.spv";
+		desc.fragmentShader = "shaders/frag.spv";
+		// describe how our vertex data is structured (the vertex shader's inputs, one after the other)
+		uint32_t stride = 0;
+		desc.vertexAttributes = m_shaderInterface.vertexAttributes(0, stride);
+		desc.vertexBindings = { { 0, stride, VK_VERTEX_INPUT_RATE_VERTEX } };
+		// the vertex buffers hold Vertex, the shader has to read it the way it is laid out
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = Vertex::getAttributeDescriptions();
+		bool sameLayout = stride == sizeof(Vertex) && std::equal(desc.vertexAttributes.begin(), desc.vertexAttributes.end(),
+			attributeDescriptions.begin(), attributeDescriptions.end(), [](const VkVertexInputAttributeDescription& a, const VkVertexInputAttributeDescription& b) {
+				return a.location == b.location && a.format == b.format && a.offset == b.offset;
+			});
+		if (!sameLayout) {
+			throw std::runtime_error("failed to create graphics pipeline, the vertex shader inputs do not match Vertex!");
+		}
+		desc.samples = m_msaaSamples;
+		desc.layout = m_pipelineLayout;
+		desc.renderPass = m_renderPass;
+		desc.subpass = 0;
+		desc.colorFormat = m_swapChainImageFormat;
+		desc.depthFormat = findDepthFormat();
+		// no specialization constants, the shaders' defaults do everything
+		m_graphicsPipeline = m_pipelines.compileNow(desc);
+		m_boundPipeline = m_graphicsPipeline;
+		m_defaultPipelineDesc = desc;
+
+		// the scene asks for its own variant, which is compiled in the background on the first frame
+		m_scenePipelineDesc = desc;
+		m_scenePipelineDesc.alphaBlend = enableBlendedVariant;
+		m_scenePipelineDesc.specialization = specializationConstants(SCENE_PERMUTATION);
+		// SPIR-V without them would ignore every permutation and draw them all the same
+		const std::vector<uint32_t>& declared = m_shaderInterface.specializationConstants;
+		for (const SpecializationConstant& constant : m_scenePipelineDesc.specialization) {
+			if (std::find(declared.begin(), declared.end(), constant.constantId) == declared.end()) {
+				throw std::runtime_error("failed to create graphics pipeline, " + desc.fragmentShader + " does not declare specialization constant " +
+					std::to_string(constant.constantId) + " (rebuild it with shaders/compiler.bat)!");
+			}
 		}
 	}
-	void createGraphicsPipeline()
+	// builds the pipeline desc describes, runs on job threads for background compiles (only reads desc and the device)
+	// parts != 0 builds only those parts of it as a pipeline library (VK_GRAPHICS_PIPELINE_LIBRARY_*_BIT_EXT, see PipelineLibrary.h)
+	VkPipeline buildGraphicsPipeline(const GraphicsPipelineDesc& desc, VkGraphicsPipelineLibraryFlagsEXT parts = 0)
 	{
-		// piece of code to run for every vertex
-		auto vertShaderCode = readFile("shaders/vert.spv");
+		PROFILE_SCOPE("buildGraphicsPipeline");
+		bool vertexStage = parts == 0 || (parts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT);
+		bool fragmentStage = parts == 0 || (parts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+		// the vertex input and fragment output parts have no shaders
+		if (!vertexStage && !fragmentStage) {
+			return createPipeline(desc, parts, nullptr, 0);
+		}
+		// piece of code to run for every vertex, compiled into the executable
+		SpirvCode vertShaderCode = embeddedShader(desc.vertexShader);
 		// piece of code to run for every fragment (pixel)
-		auto fragShaderCode = readFile("shaders/frag.spv");
+		SpirvCode fragShaderCode = embeddedShader(desc.fragmentShader);
+#ifdef ENABLE_SHADER_HOT_RELOAD
+		// the shaders have been edited since startup, use what they compiled to
+		std::vector<uint32_t> vertReloaded, fragReloaded;
+		if (desc.shaderRevision > 0 && m_shaderHotReload.code(desc.vertexShader, vertReloaded)) {
+			vertShaderCode = { vertReloaded.data(), vertReloaded.size() };
+		}
+		if (desc.shaderRevision > 0 && m_shaderHotReload.code(desc.fragmentShader, fragReloaded)) {
+			fragShaderCode = { fragReloaded.data(), fragReloaded.size() };
+		}
+#endif
+		// descriptor sets are bound with desc.layout, shaders which declare something else would read garbage
+		// (it is made for every shader the renderer has, a pair of them may use less of it)
+		ShaderReflection shaderInterface = reflectShader(vertShaderCode.words, vertShaderCode.wordCount, VK_SHADER_STAGE_VERTEX_BIT);
+		shaderInterface.merge(reflectShader(fragShaderCode.words, fragShaderCode.wordCount, VK_SHADER_STAGE_FRAGMENT_BIT));
+		if (desc.layout != m_pipelineLayout || !shaderInterface.fits(m_shaderInterface)) {
+			throw std::runtime_error("failed to create graphics pipeline, the shaders do not match its pipeline layout!");
+		}
 		//std::cout << "Size of vert shader code: " << vertShaderCode.size() << std::endl;
 		//std::cout << "Size of frag shader code: " << fragShaderCode.size() << std::endl;
-		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode); // create a shader module from the code
-		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode); // create a shader module from the code
+		VkShaderModule vertShaderModule = vertexStage ? createShaderModule(vertShaderCode) : VK_NULL_HANDLE; // create a shader module from the code
+		VkShaderModule fragShaderModule = fragmentStage ? createShaderModule(fragShaderCode) : VK_NULL_HANDLE; // create a shader module from the code
 
 		// create vertex shader stage info
 		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
@@ -1031,41 +1572,58 @@ private:
 		fragShaderStageInfo.module = fragShaderModule;
 		fragShaderStageInfo.pName = "main"; // entry point
 
-		// array to hold both the stages
-		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+		// specialization constants of each stage, one 32 bit value after the other
+		auto specialize = [&desc](VkShaderStageFlagBits stage, std::vector<VkSpecializationMapEntry>& entries, std::vector<uint32_t>& data,
+			VkSpecializationInfo& info) -> const VkSpecializationInfo* {
+			for (const SpecializationConstant& constant : desc.specialization) {
+				if (constant.stage != stage) continue;
+				entries.push_back({ constant.constantId, static_cast<uint32_t>(data.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+				data.push_back(constant.value);
+			}
+			if (entries.empty()) return nullptr;
+			info.mapEntryCount = static_cast<uint32_t>(entries.size());
+			info.pMapEntries = entries.data();
+			info.dataSize = data.size() * sizeof(uint32_t);
+			info.pData = data.data();
+			return &info;
+		};
+		std::vector<VkSpecializationMapEntry> vertSpecializationEntries, fragSpecializationEntries;
+		std::vector<uint32_t> vertSpecializationData, fragSpecializationData;
+		VkSpecializationInfo vertSpecialization{}, fragSpecialization{};
+		vertShaderStageInfo.pSpecializationInfo = specialize(VK_SHADER_STAGE_VERTEX_BIT, vertSpecializationEntries, vertSpecializationData, vertSpecialization);
+		fragShaderStageInfo.pSpecializationInfo = specialize(VK_SHADER_STAGE_FRAGMENT_BIT, fragSpecializationEntries, fragSpecializationData, fragSpecialization);
+
+		// array to hold the stages (both of them, unless this is one shader part of a library)
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+		if (vertexStage) shaderStages.push_back(vertShaderStageInfo);
+		if (fragmentStage) shaderStages.push_back(fragShaderStageInfo);
+		VkPipeline pipeline = createPipeline(desc, parts, shaderStages.data(), static_cast<uint32_t>(shaderStages.size()));
 
+		// destroy shader modules linked to the logical device, since we now havd them in an array already
+		if (fragmentStage) vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
+		if (vertexStage) vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+		return pipeline;
+	}
+	// the fixed function state around the shader stages, everything a library part does not contain is ignored by the driver
+	VkPipeline createPipeline(const GraphicsPipelineDesc& desc, VkGraphicsPipelineLibraryFlagsEXT parts,
+		const VkPipelineShaderStageCreateInfo* shaderStages, uint32_t stageCount)
+	{
 		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-		// describe how our vertex data is structured
-		VkVertexInputBindingDescription bindingDescription = Vertex::getBindingDescription();
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = Vertex::getAttributeDescriptions();
-
 		// tell our graphics pipeline how the vertex data is structured
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription; // Optional
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // Optional
+		vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertexBindings.size());
+		vertexInputInfo.pVertexBindingDescriptions = desc.vertexBindings.data(); // Optional
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexAttributes.size());
+		vertexInputInfo.pVertexAttributeDescriptions = desc.vertexAttributes.data(); // Optional
 
 		// settings to configure the assembly of geometry from vertices
 		VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
 		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		inputAssembly.topology = desc.topology;
 		inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-		// viewport and scissor
-		VkViewport viewport{};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)m_swapChainExtent.width;
-		viewport.height = (float)m_swapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-
-		VkRect2D scissor{};
-		scissor.offset = { 0, 0 };
-		scissor.extent = m_swapChainExtent;
-
+		// viewport and scissor are set when drawing, so the pipeline does not depend on the swap chain size
 		VkPipelineDynamicStateCreateInfo dynamicState{};
 		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
@@ -1075,18 +1633,18 @@ private:
 		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewportState.viewportCount = 1;
 		viewportState.scissorCount = 1;
-		viewportState.pViewports = &viewport;
-		viewportState.pScissors = &scissor;
+		viewportState.pViewports = nullptr; // dynamic
+		viewportState.pScissors = nullptr; // dynamic
 
 		VkPipelineRasterizationStateCreateInfo rasterizer{};
 		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 		rasterizer.depthClampEnable = VK_FALSE;
 		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.polygonMode = desc.polygonMode;
 		rasterizer.lineWidth = 1.0f;
 
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterizer.cullMode = desc.cullMode;
+		rasterizer.frontFace = desc.frontFace;
 
 		rasterizer.depthBiasEnable = VK_FALSE;
 		rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -1097,7 +1655,7 @@ private:
 		VkPipelineMultisampleStateCreateInfo multisampling{};
 		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
 		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = m_msaaSamples;
+		multisampling.rasterizationSamples = desc.samples;
 		multisampling.minSampleShading = 1.0f; // Optional
 		multisampling.pSampleMask = nullptr; // Optional
 		multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
@@ -1106,8 +1664,8 @@ private:
 		// depth buffer configuration
 		VkPipelineDepthStencilStateCreateInfo depthStencil{};
 		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depthStencil.depthTestEnable = VK_TRUE;
-		depthStencil.depthWriteEnable = VK_TRUE;
+		depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+		depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
 		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
 		depthStencil.depthBoundsTestEnable = VK_FALSE;
 		depthStencil.minDepthBounds = 0.0f; // Optional
@@ -1116,12 +1674,12 @@ private:
 		depthStencil.front = {}; // Optional
 		depthStencil.back = {}; // Optional
 
-		// color blending first method (disabled)
+		// color blending first method (alpha blending for the variants which ask for it)
 		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
 		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+		colorBlendAttachment.blendEnable = desc.alphaBlend ? VK_TRUE : VK_FALSE;
+		colorBlendAttachment.srcColorBlendFactor = desc.alphaBlend ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE; // Optional
+		colorBlendAttachment.dstColorBlendFactor = desc.alphaBlend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO; // Optional
 		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
 		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
 		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
@@ -1139,23 +1697,10 @@ private:
 		colorBlending.blendConstants[2] = 0.0f; // Optional
 		colorBlending.blendConstants[3] = 0.0f; // Optional
 
-		// pipeline layout (information about descriptor layouts)
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 1; // uniform layout
-		pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout; // Optional
-
-		pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-		pipelineLayoutInfo.pPushConstantRanges = 0; // Optional
-
-		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create pipeline layout!");
-		}
-
 		// graphics pipeline creation
 		VkGraphicsPipelineCreateInfo pipelineInfo{};
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = 2;
+		pipelineInfo.stageCount = stageCount;
 		pipelineInfo.pStages = shaderStages;
 		pipelineInfo.pVertexInputState = &vertexInputInfo;
 		pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -1165,22 +1710,56 @@ private:
 		pipelineInfo.pDepthStencilState = &depthStencil; // depth buffer
 		pipelineInfo.pColorBlendState = &colorBlending;
 		pipelineInfo.pDynamicState = &dynamicState; // viewport and scissor
-		pipelineInfo.layout = m_pipelineLayout;
-		pipelineInfo.renderPass = m_renderPass;
-		pipelineInfo.subpass = 0;
+		pipelineInfo.layout = desc.layout;
+		pipelineInfo.renderPass = desc.renderPass;
+		pipelineInfo.subpass = desc.subpass;
 		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 		pipelineInfo.basePipelineIndex = -1; // Optional
 
-		if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create graphics pipeline!");
+		// ask the driver whether the pipeline came out of the cache
+		PersistentPipelineCache::CreationFeedback feedback;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		bool feedbackRequested = m_pipelineCache.creationFeedback(feedback, pipelineInfo.stageCount) != nullptr;
+		if (feedbackRequested) {
+			pipelineInfo.pNext = &feedback.info;
+		}
+		// without a render pass the pipeline is told the attachment formats instead
+		VkPipelineRenderingCreateInfo renderingInfo{};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachmentFormats = &desc.colorFormat;
+		renderingInfo.depthAttachmentFormat = desc.depthFormat;
+		if (desc.renderPass == VK_NULL_HANDLE) {
+			renderingInfo.pNext = pipelineInfo.pNext;
+			pipelineInfo.pNext = &renderingInfo;
+		}
+		// a library part keeps what link time optimization needs, the optimized link compiles it all again
+		VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+		libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+		libraryInfo.flags = parts;
+		if (parts != 0) {
+			pipelineInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+			libraryInfo.pNext = const_cast<void*>(pipelineInfo.pNext);
+			pipelineInfo.pNext = &libraryInfo;
 		}
-
-		// destroy shader modules linked to the logical device, since we now havd them in an array already
-		vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
-		vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+		{
+			PROFILE_SCOPE("vkCreateGraphicsPipelines");
+			auto creationBegin = std::chrono::high_resolution_clock::now();
+			if (vkCreateGraphicsPipelines(m_device, m_pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create graphics pipeline!");
+			}
+			m_pipelineCache.recordCreation(feedbackRequested ? &feedback : nullptr,
+				std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - creationBegin).count());
+		}
+		return pipeline;
 	}
 	void createFramebuffers()
 	{
+		PROFILE_SCOPE("createFramebuffers");
+		// dynamic rendering renders to the image views themselves, so a resize has no framebuffers to rebuild either
+		if (m_dynamicRendering) {
+			return;
+		}
 		// resize the framebuffer array to fit the number of swapchain images
 		m_swapChainFramebuffers.resize(m_swapChainImageViews.size());
 
@@ -1209,6 +1788,7 @@ private:
 	}
 	void createCommandPool()
 	{
+		PROFILE_SCOPE("createCommandPool");
 		/*	a command pool is a memory pool that is used to manage the memory resources for command buffers.
 		Think of a command buffer as a list of instructions that tell the GPU what to do, such as drawing objects or updating buffers.
 		The command pool is responsible for allocating and managing the memory used by these command buffers.
@@ -1230,14 +1810,15 @@ private:
 	}
 	void createDepthResources()
 	{
+		PROFILE_SCOPE("createDepthResources");
 		// takes a list of candidate formats in order from most desirable to least desirable,
 		// and checks which is the first one that is supported:
 		VkFormat depthFormat = findDepthFormat();
-		createImage(m_swapChainExtent.width, m_swapChainExtent.height,
+		createImage(m_renderTargetExtent.width, m_renderTargetExtent.height,
 			depthFormat, VK_IMAGE_TILING_OPTIMAL,
 			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			m_depthImage, m_depthImageMemory, 1, m_msaaSamples);
-		m_depthImageView = createImageView(m_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+			m_depthImage, m_depthImageMemory, 1, m_msaaSamples, 1);
+		m_depthImageView = createImageView(m_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, 1);
 	}
 	VkFormat findSupportedDepthFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags feature)
 	{
@@ -1275,92 +1856,154 @@ private:
 		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 	}
 
-	// load an image from file and upload it to Vulkan Image Object
+	// load every scene texture from file, pack them together and upload the result to a Vulkan Image Object
+	// CPU only, runs as a startup job
+	void decodeTextures()
+	{
+		PROFILE_SCOPE("decodeTextures");
+		// decode all the textures
+		std::vector<SourceTexture> sourceTextures;
+		for (const std::string& path : TEXTURE_PATHS)
+		{
+			PROFILE_SCOPE("decode");
+			// store texture image width, height and number of color channels
+			int texWidth, texHeight, texChannels;
+			// decode the image straight out of the mapped file
+			MappedFile file(path);
+			stbi_uc* pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+			if (!pixels) {
+				throw std::runtime_error("failed to load texture image!");
+			}
+			SourceTexture texture;
+			texture.name = path;
+			texture.width = static_cast<uint32_t>(texWidth);
+			texture.height = static_cast<uint32_t>(texHeight);
+			texture.pixels.assign(pixels, pixels + size_t(texWidth) * texHeight * 4); // 4 bytes per pixel
+			// free the image data
+			stbi_image_free(pixels);
+			sourceTextures.push_back(std::move(texture));
+		}
+
+		// pack them into as few images as possible
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		TexturePacker packer(TEXTURE_PACK_MODE, 4, properties.limits.maxImageDimension2D);
+		{
+			PROFILE_SCOPE("pack");
+			m_packedTextures = packer.pack(sourceTextures);
+		}
+	}
 	void createTextureImage()
 	{
-		// store texture image width, height and number of color channels
-		int texWidth, texHeight, texChannels;
-		// load the image data from file
-		// stbi_uc* pixels = stbi_load("textures/texture.jpg", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		// calculate image size in bytes
-		VkDeviceSize imageSize = texWidth * texHeight * 4; // 4 bytes per pixel
-		// maximum mip levels that can be formed
-		// calculate the number of mip levels possible for this image	
-		m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texHeight, texWidth)))) + 1;
-
-		if (!pixels) {
-			throw std::runtime_error("failed to load texture image!");
-		}
-
-		// VkBuffer is a logical abstraction for data storage, whereas VkDeviceMemory is a physical representation of memory on the device.
-
-		// create a staging buffer (on CPU ) to copy the image data to before copying to the device local buffer (on GPU)
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		// create the staging buffer (required size of the buffer, will be used as SOURCE of a transfer command,
-		// can be used for mapping and flushing not necceary, output results)
-		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer, stagingBufferMemory);
-
-		// map staging buffer memory to a pointer so we can copy image data to it
-		// The reason for mapping and unmapping memory is to ensure that the CPU and GPU can access the same memory regions without conflicts.
-		void* data;
-		vkMapMemory(m_device, stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(m_device, stagingBufferMemory);
-
-		// free the image data
-		stbi_image_free(pixels);
-
-		// create the image with three usage flags
-		// VK_IMAGE_USAGE_TRANSFER_DST_BIT| VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			m_textureImage, m_textureImageMemory, m_mipLevels, VK_SAMPLE_COUNT_1_BIT);
-
-		// change the layout of the image from old to a new one which is better for GPU
-		// begins with the texture image in an undefined layout, which is optimal for copying the texels from the staging buffer to.
-		// ends with the texture image in a layout that is optimal for transfer destination 
-		// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL layout is specifically 
-		// designed for efficient transfer operations when the image is the destination.
-		transitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, 
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels);
-		// copy image data to VkImage object
-		copyBufferToImage(stagingBuffer, m_textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-
-		// change the layout of this image object for opitmal GPU access
-		// transitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-			// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_mipLevels);
-
-		// texture image now has 11 mip levels
-		generateMipmaps(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, m_mipLevels);
-
-		vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-		vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-	}
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-		VkBufferImageCopy region{};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-		region.imageOffset = { 0, 0, 0 };
-		region.imageExtent = { width, height, 1, };
-
-		vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		endSingleTimeCommands(commandBuffer);
+		PROFILE_SCOPE("createTextureImage");
+		const TexturePackResult& packed = m_packedTextures;
+		const TexturePackStats& stats = packed.stats;
+		std::cout << "texture packer: " << stats.sourceImages << " images -> " << stats.packedImages << " images ("
+			<< stats.packedLayers << " layers), " << stats.sourceBytes / 1024 << " KiB -> " << stats.packedBytes / 1024 << " KiB\n";
+
+		// the fragment shader has a sampler2DArray per packed image
+		if (packed.images.size() > MAX_TEXTURE_IMAGES) {
+			throw std::runtime_error("packed textures need more images than the fragment shader can sample!");
+		}
+		m_textureRegions = packed.regions;
+
+		for (const PackedTextureImage& image : packed.images)
+		{
+			TextureImage texture{};
+			texture.layerCount = image.layerCount;
+			VkDeviceSize imageSize = image.pixels.size();
+			// maximum mip levels that can be formed
+			// calculate the number of mip levels possible for this image
+			texture.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(image.width, image.height)))) + 1;
+
+			// create the image with three usage flags
+			// VK_IMAGE_USAGE_TRANSFER_DST_BIT| VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			createImage(image.width, image.height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				texture.image, texture.memory, texture.mipLevels, VK_SAMPLE_COUNT_1_BIT, texture.layerCount);
+			m_textureImages.push_back(texture);
+
+			// change the layout of the image from old to a new one which is better for GPU
+			// begins with the texture image in an undefined layout, which is optimal for copying the texels from the staging buffer to.
+			// ends with the texture image in a layout that is optimal for transfer destination 
+			// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL layout is specifically 
+			// designed for efficient transfer operations when the image is the destination.
+			transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, 
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.mipLevels, texture.layerCount);
+			// copy the image data into staging memory (CPU visible), split into whole rows if it does not fit into one chunk
+			std::vector<StagingSpan> spans = m_stagingPool.stage(image.pixels.data(), imageSize, VkDeviceSize(image.width) * 4);
+			// copy image data to VkImage object
+			copyBufferToImage(spans, texture.image, image.width, image.height, texture.layerCount);
+			// the copies ran on the transfer queue, mipmaps are blitted on the graphics queue (the layout stays the same)
+			VkImageSubresourceRange textureRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, texture.layerCount };
+			m_uploads.transferToGraphics(texture.image, textureRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+			// change the layout of this image object for opitmal GPU access
+			// transitionImageLayout(texture.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+				// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, texture.mipLevels);
+
+			// generate every mip level of every layer
+			generateMipmaps(texture.image, VK_FORMAT_R8G8B8A8_SRGB, image.width, image.height, texture.mipLevels, texture.layerCount);
+		}
+		// the pixels have been staged
+		m_packedTextures = TexturePackResult{};
+	}
+	// copies staged, tightly packed layers into mip level 0 of every layer of the image
+	// every span holds whole rows, a span can start in one layer and end in the next
+	void copyBufferToImage(const std::vector<StagingSpan>& spans, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) {
+		VkCommandBuffer commandBuffer = beginUploadCommands();
+
+		const VkDeviceSize rowPitch = VkDeviceSize(width) * 4; // 4 bytes per pixel
+		for (const StagingSpan& span : spans)
+		{
+			std::vector<VkBufferImageCopy> regions;
+			// rows are counted over all layers: row r is row (r % height) of layer (r / height)
+			uint32_t firstRow = static_cast<uint32_t>(span.sourceOffset / rowPitch);
+			uint32_t rowCount = static_cast<uint32_t>(span.size / rowPitch);
+			if (uint64_t(firstRow) + rowCount > uint64_t(layerCount) * height) {
+				throw std::runtime_error("failed to copy buffer to image, the staged rows run past the last layer!");
+			}
+			for (uint32_t row = firstRow; row < firstRow + rowCount;)
+			{
+				uint32_t layer = row / height;
+				uint32_t rowInLayer = row % height;
+				uint32_t rowsLeft = firstRow + rowCount - row;
+
+				VkBufferImageCopy region{};
+				region.bufferOffset = span.offset + VkDeviceSize(row - firstRow) * rowPitch;
+				region.bufferRowLength = 0; // tightly packed
+				region.bufferImageHeight = 0; // layers follow each other without gaps
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.mipLevel = 0;
+				region.imageSubresource.baseArrayLayer = layer;
+				if (rowInLayer == 0 && rowsLeft >= height) {
+					// whole layers go in one region
+					region.imageSubresource.layerCount = rowsLeft / height;
+					region.imageOffset = { 0, 0, 0 };
+					region.imageExtent = { width, height, 1 };
+					row += region.imageSubresource.layerCount * height;
+				}
+				else {
+					// the rest of a layer, or the start of one
+					uint32_t rows = std::min(height - rowInLayer, rowsLeft);
+					region.imageSubresource.layerCount = 1;
+					region.imageOffset = { 0, static_cast<int32_t>(rowInLayer), 0 };
+					region.imageExtent = { width, rows, 1 };
+					row += rows;
+				}
+				regions.push_back(region);
+			}
+			vkCmdCopyBufferToImage(commandBuffer, span.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(regions.size()), regions.data());
+		}
+
+		endUploadCommands();
 	}
 	// creates an image with desired widht, height, format, tiling, usage, memory properties
 	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling imageTiling, VkImageUsageFlags usageFlags,
-		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels, VkSampleCountFlagBits numSamples)
+		VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels, VkSampleCountFlagBits numSamples,
+		uint32_t arrayLayers)
 	{
 		// create an image object
 		VkImageCreateInfo imageInfo{};
@@ -1370,7 +2013,7 @@ private:
 		imageInfo.extent.height = height; // height of image
 		imageInfo.extent.depth = 1; // depth of image (1 for 2D image)
 		imageInfo.mipLevels = mipLevels; // number of mipmap levels (1 = currently no mipmapping) available for this image
-		imageInfo.arrayLayers = 1; // number of layers in image array (1 = currently texture is not an array)
+		imageInfo.arrayLayers = arrayLayers; // number of layers in image array (1 = not an array)
 		imageInfo.format = format; // format of texels (pixels)
 		imageInfo.tiling = imageTiling; // tiling of image data
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // layout of image data on creation
@@ -1388,36 +2031,50 @@ private:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(m_device, image, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size; // size of memory allocation
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties); // index of memory type to use
-
-		// allocate memory
-		if (vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
-		}
+		// render targets are big and get recreated on resize, they get memory of their own
+		bool renderTarget = (usageFlags & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) != 0;
+		imageMemory = m_allocator.allocate(memRequirements, properties,
+			imageTiling == VK_IMAGE_TILING_OPTIMAL ? MemoryResourceKind::Optimal : MemoryResourceKind::Linear, renderTarget);
 
-		// bind the image to the allocated memory
-		vkBindImageMemory(m_device, image, imageMemory, 0);
+		// bind the image to its place in the allocated memory
+		vkBindImageMemory(m_device, image, imageMemory.memory, imageMemory.offset);
 	}
 	void createTextureImageView()
 	{
-		m_textureImageView = createImageView(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, m_mipLevels);
+		PROFILE_SCOPE("createTextureImageView");
+		// the fragment shader samples arrays, so even an image with one layer gets an array view
+		for (TextureImage& texture : m_textureImages)
+		{
+			texture.view = createImageView(texture.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, texture.mipLevels, texture.layerCount,
+				VK_IMAGE_VIEW_TYPE_2D_ARRAY);
+		}
 	}
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+	// every texture image for the texSampler array, slots without a packed image repeat the first one
+	std::array<VkDescriptorImageInfo, MAX_TEXTURE_IMAGES> textureImageInfos() const
+	{
+		std::array<VkDescriptorImageInfo, MAX_TEXTURE_IMAGES> imageInfos{};
+		for (uint32_t i = 0; i < MAX_TEXTURE_IMAGES; i++)
+		{
+			imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[i].imageView = m_textureImages[i < m_textureImages.size() ? i : 0].view;
+			imageInfos[i].sampler = m_textureSampler;
+		}
+		return imageInfos;
+	}
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t layerCount,
+		VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D)
 	{
 		VkImageView imageView;
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.viewType = viewType;
 		viewInfo.format = format;
 		viewInfo.subresourceRange.aspectMask = aspectFlags; // color aspect of image
 		viewInfo.subresourceRange.baseMipLevel = 0; // start at mip level 0
 		viewInfo.subresourceRange.levelCount = mipLevels; // total number mip level
 		viewInfo.subresourceRange.baseArrayLayer = 0; // start at array layer 0
-		viewInfo.subresourceRange.layerCount = 1; // 1 layer
+		viewInfo.subresourceRange.layerCount = layerCount; // total number of array layers
 
 		if (vkCreateImageView(m_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create texture image view!");
@@ -1426,13 +2083,17 @@ private:
 	}
 	void createTextureSampler()
 	{
+		PROFILE_SCOPE("createTextureSampler");
 		VkSamplerCreateInfo samplerInfo{};
 		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 		samplerInfo.magFilter = VK_FILTER_LINEAR; // how to interpolate texels that are magnified on screen
 		samplerInfo.minFilter = VK_FILTER_LINEAR; // how to interpolate texels that are minified on screen
-		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT; // how to handle texture coordinates outside of [0,1] range in U direction
-		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT; // how to handle texture coordinates outside of [0,1] range in V direction
-		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT; // how to handle texture coordinates outside of [0,1] range in W direction
+		// a packed texture is surrounded by padding or by other textures, the fragment shader wraps the uvs inside its rect
+		// and the sampler must not wrap around the whole layer
+		VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeU = addressMode; // how to handle texture coordinates outside of [0,1] range in U direction
+		samplerInfo.addressModeV = addressMode; // how to handle texture coordinates outside of [0,1] range in V direction
+		samplerInfo.addressModeW = addressMode; // how to handle texture coordinates outside of [0,1] range in W direction
 
 		samplerInfo.anisotropyEnable = VK_TRUE; // enable anisotropic filtering
 
@@ -1447,7 +2108,11 @@ private:
 
 		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerInfo.minLod = 0.0f; // Optional
-		samplerInfo.maxLod = static_cast<float>(m_mipLevels);
+		uint32_t mipLevels = 1;
+		for (const TextureImage& texture : m_textureImages) {
+			mipLevels = std::max(mipLevels, texture.mipLevels);
+		}
+		samplerInfo.maxLod = static_cast<float>(mipLevels); // one sampler for every image, each view clamps to its own levels
 		samplerInfo.mipLodBias = 0.0f; // Optional
 
 		// create sampler
@@ -1455,24 +2120,54 @@ private:
 			throw std::runtime_error("failed to create texture sampler!");
 		}
 	}
+	// CPU only, runs as a startup job (the uvs are remapped once the textures are packed)
 	void loadModel()
 	{	// The attrib container holds all of the positions, normals and texture coordinates
 		// in its attrib.vertices, attrib.normals and attrib.texcoords vectors.
+		PROFILE_SCOPE("loadModel");
 		tinyobj::attrib_t attrib; // contains all vertex data
 		std::vector<tinyobj::shape_t> shapes;;
 		std::vector<tinyobj::material_t> materials;
 		std::string warn, err;
 
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
 		{
-			throw std::runtime_error(warn + err);
+			PROFILE_SCOPE("parse obj");
+			// parsed straight out of the mapped file, the .mtl files it names are next to it (in the model's directory)
+			MappedFile file(MODEL_PATH);
+			MappedFileStream stream(file);
+			size_t lastSeparator = MODEL_PATH.find_last_of('/');
+			std::string modelDirectory = lastSeparator == std::string::npos ? std::string() : MODEL_PATH.substr(0, lastSeparator);
+			tinyobj::MaterialFileReader materialReader(modelDirectory);
+			if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream, &materialReader))
+			{
+				throw std::runtime_error(warn + err);
+			}
+		}
+		PROFILE_SCOPE("deduplicate vertices");
+
+		// the TEXTURE_PATHS entry of every material, matched by file name (the .mtl paths are relative to the model)
+		auto fileName = [](const std::string& path) {
+			size_t separator = path.find_last_of("/\\");
+			return separator == std::string::npos ? path : path.substr(separator + 1);
+		};
+		std::vector<uint32_t> materialTextures(materials.size(), 0);
+		for (size_t material = 0; material < materials.size(); material++)
+		{
+			for (uint32_t texture = 0; texture < TEXTURE_PATHS.size(); texture++)
+			{
+				if (!materials[material].diffuse_texname.empty() && fileName(materials[material].diffuse_texname) == fileName(TEXTURE_PATHS[texture])) {
+					materialTextures[material] = texture;
+				}
+			}
 		}
 
 		// for all faces
 		for (const auto& shape : shapes)
 		{
-			for (const auto& index : shape.mesh.indices)
+			for (size_t i = 0; i < shape.mesh.indices.size(); i++)
 			{
+				const tinyobj::index_t& index = shape.mesh.indices[i];
+				int material = shape.mesh.material_ids.empty() ? -1 : shape.mesh.material_ids[i / 3];
 				// fetch the vertex data from the attrib container
 				Vertex vertex{};
 				vertex.pos = {
@@ -1485,8 +2180,8 @@ private:
 					attrib.texcoords[2 * index.texcoord_index + 0],
 					1 - attrib.texcoords[2 * index.texcoord_index + 1]
 				};
-
 				vertex.color = { 1.0f, 1.0f, 1.0f };
+				vertex.texSlot.x = material < 0 ? 0 : materialTextures[material];
 
 				// is this vertex unique?
 				if (m_uniqueVertices.count(vertex) == 0)
@@ -1499,79 +2194,69 @@ private:
 			}
 		}
 	}
+	// point every vertex at where the packer put its own texture, the uvs stay in [0, 1] of that texture
+	// so they can repeat it (the fragment shader maps them into the rect)
+	// (m_uniqueVertices keeps the TEXTURE_PATHS indices of the obj file)
+	void remapModelTexCoords()
+	{
+		PROFILE_SCOPE("remapModelTexCoords");
+		for (Vertex& vertex : m_vertices)
+		{
+			const PackedTextureRegion& region = m_textureRegions[vertex.texSlot.x];
+			vertex.texRect = glm::vec4(region.uvOffset, region.uvScale);
+			vertex.texSlot = { region.imageIndex, region.layer };
+		}
+	}
 	void createVertexBuffer()
 	{
+		PROFILE_SCOPE("createVertexBuffer");
 		VkDeviceSize bufferSize = sizeof(m_vertices[0]) * m_vertices.size();
 		// createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		//	m_vertexBuffer, m_vertexBufferMemory);
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		// create a staging buffer to copy vertex data to before copying to the device local buffer
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer, stagingBufferMemory);
-
-		// map staging buffer memory to a pointer so we can copy vertex data to it
-		void* data;
-		vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, m_vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(m_device, stagingBufferMemory);
+		// copy vertex data into staging memory before copying it to the device local buffer
+		std::vector<StagingSpan> spans = m_stagingPool.stage(m_vertices.data(), bufferSize);
 
 		// create a vertex buffer on the device local memory
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferMemory);
 
-		// copy the staging buffer to the vertex buffer
-		copyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
-
-		vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-		vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+		// copy the staged data to the vertex buffer
+		copyBuffer(spans, m_vertexBuffer, 0);
+		// hand it to the graphics queue for vertex input
+		m_uploads.transferToGraphics(m_vertexBuffer, 0, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 	}
 	void createIndexBuffer()
 	{
+		PROFILE_SCOPE("createIndexBuffer");
 		VkDeviceSize bufferSize = sizeof(m_indices[0]) * m_indices.size();
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		// create a staging buffer to copy index data to before copying to the device local buffer
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer, stagingBufferMemory);
-
-		// map staging buffer memory to a pointer so we can copy index data to it
-		void* data;
-		vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, m_indices.data(), (size_t)bufferSize);
-		vkUnmapMemory(m_device, stagingBufferMemory);
+		// copy index data into staging memory before copying it to the device local buffer
+		std::vector<StagingSpan> spans = m_stagingPool.stage(m_indices.data(), bufferSize);
 
 		// create a index buffer on the device local memory
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferMemory);
 
-		// copy the staging buffer to the vertex buffer
-		copyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
-
-		vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-		vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+		// copy the staged data to the index buffer
+		copyBuffer(spans, m_indexBuffer, 0);
+		// hand it to the graphics queue for index reads
+		m_uploads.transferToGraphics(m_indexBuffer, 0, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 	}
 	void createUniformBuffers() {
-		VkDeviceSize size = sizeof(UniformBufferObject);
-		m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-		m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-		m_uniformBuffersData.resize(MAX_FRAMES_IN_FLIGHT);
-
-		// create a uniform buffer for each frame in flight
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-		{
-			createBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				m_uniformBuffers[i], m_uniformBuffersMemory[i]);
-			vkMapMemory(m_device, m_uniformBuffersMemory[i], 0, size, 0, &m_uniformBuffersData[i]);
-		}
+		PROFILE_SCOPE("createUniformBuffers");
+		// one persistently mapped buffer for all frames in flight, the uniform buffer objects of every frame
+		// are the constants block of its region
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+		m_objectConstantsStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+		VkDeviceSize constantsSize = enableDynamicUniformBuffer ? m_objectConstantsStride * MAX_OBJECTS : sizeof(UniformBufferObject);
+		m_frameAllocator.init(physicalDevice, m_device, m_allocator, MAX_FRAMES_IN_FLIGHT, constantsSize, FRAME_RING_SIZE);
 	}
 	void copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size)
 	{
-		// make a one time command buffer to submit copy command
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		// record the copy into the current upload batch
+		VkCommandBuffer commandBuffer = beginUploadCommands();
 
 		VkBufferCopy copyRegion{};
 		copyRegion.srcOffset = 0; // soruce buffer offset
@@ -1582,49 +2267,90 @@ private:
 		vkCmdCopyBuffer(commandBuffer, src, dst, 1, &copyRegion);
 
 		// end the command buffer
-		endSingleTimeCommands(commandBuffer);
+		endUploadCommands();
 	}
-	// create a single use command buffer from the command pool
-	VkCommandBuffer beginSingleTimeCommands() {
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = m_commandPool;
-		allocInfo.commandBufferCount = 1;
-
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
-
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	// copy staged data to dst, starting at dstOffset
+	void copyBuffer(const std::vector<StagingSpan>& spans, VkBuffer dst, VkDeviceSize dstOffset)
+	{
+		VkCommandBuffer commandBuffer = beginUploadCommands();
 
-		// the command buffer is ready to accept commands, and any subsequent Vulkan commands issued will be recorded into the buffer
-		// until vkEndCommandBuffer is called to finalize the buffer recording.
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		// spans can live in different staging chunks (buffers), so one copy command per span
+		for (const StagingSpan& span : spans)
+		{
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = span.offset;
+			copyRegion.dstOffset = dstOffset + span.sourceOffset;
+			copyRegion.size = span.size;
+			vkCmdCopyBuffer(commandBuffer, span.buffer, dst, 1, &copyRegion);
+		}
 
-		return commandBuffer;
+		endUploadCommands();
 	}
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-		// end accepting more commands into the command buffer
-		vkEndCommandBuffer(commandBuffer);
-
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-
-		// submit whatever commands are in the commandBuffer to the queue
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
-
-		// destroy the command buffer
-		vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+	void createUploadResources()
+	{
+		PROFILE_SCOPE("createUploadResources");
+		m_stagingPool.init(physicalDevice, m_device, m_allocator);
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+		uint32_t graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+		m_uploads.init(m_device, queueFamilyIndices.transferFamily.value_or(graphicsFamily), m_transferQueue, graphicsFamily, graphicsQueue,
+			m_stagingPool, m_timeline);
+	}
+	// the renderer as the startup benchmarks see it (see Benchmarks.h)
+	BenchmarkRenderer benchmarkRenderer()
+	{
+		BenchmarkRenderer renderer;
+		renderer.device = m_device;
+		renderer.graphicsFamily = findQueueFamilies(physicalDevice).graphicsFamily.value();
+		renderer.allocator = &m_allocator;
+		renderer.stagingPool = &m_stagingPool;
+		renderer.createBuffer = [this](VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer,
+			MemoryAllocation& memory) { createBuffer(size, usage, properties, buffer, memory); };
+		renderer.copyBuffer = [this](VkBuffer src, VkBuffer dst, VkDeviceSize size) { copyBuffer(src, dst, size); };
+		renderer.copyStaged = [this](const std::vector<StagingSpan>& spans, VkBuffer dst, VkDeviceSize dstOffset) {
+			copyBuffer(spans, dst, dstOffset);
+		};
+		renderer.flushUploads = [this]() { flushUploads(); };
+		renderer.drawInheritance = [this](VkCommandBufferInheritanceRenderingInfo& rendering) { return drawInheritance(0, rendering); };
+		renderer.recordDraws = [this](VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount) {
+			recordDraws(commandBuffer, firstDraw, drawCount);
+		};
+		renderer.bindDrawState = [this](VkCommandBuffer commandBuffer) { bindDrawState(commandBuffer); };
+		renderer.pipelineLayout = m_pipelineLayout;
+		renderer.indexCount = static_cast<uint32_t>(m_indices.size());
+		renderer.aspectRatio = m_swapChainExtent.width / (float)m_swapChainExtent.height;
+		renderer.shaderInterface = &m_shaderInterface;
+		renderer.descriptorSetLayout = m_descriptorSetLayout;
+		renderer.objectConstantsStride = m_objectConstantsStride;
+		std::array<VkDescriptorImageInfo, MAX_TEXTURE_IMAGES> textureImages = textureImageInfos();
+		renderer.textureImages.assign(textureImages.begin(), textureImages.end());
+		renderer.dynamicUniformBuffer = enableDynamicUniformBuffer;
+		return renderer;
+	}
+	// command buffer to record an upload into, all uploads until the next m_uploads.submit() end up in the same one
+	// runs on the transfer queue, so only copies and barriers for the transfer stage can go in there
+	VkCommandBuffer beginUploadCommands() {
+		return m_uploads.record();
+	}
+	// for upload work which needs the graphics queue (blits, barriers for shader stages),
+	// it runs after the commands recorded with beginUploadCommands() of the same batch
+	VkCommandBuffer beginGraphicsUploadCommands() {
+		return m_uploads.recordGraphics();
+	}
+	// with batched uploads the recorded commands are submitted together later,
+	// otherwise they are submitted and waited for right away
+	void endUploadCommands() {
+		if (!enableBatchedUploads) {
+			flushUploads();
+		}
+	}
+	// submit whatever has been recorded and wait for it, staging memory it used can be reused afterwards
+	void flushUploads() {
+		m_uploads.wait(m_uploads.submit());
 	}
 	// converts an VkImage object with a particular format and a layout to another VkImage object with a different layout
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-		// start a command buffer
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, uint32_t layerCount) {
+		// start a command buffer, the transfer queue cannot wait for shader stages
+		VkCommandBuffer commandBuffer = newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? beginGraphicsUploadCommands() : beginUploadCommands();
 
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1637,7 +2363,7 @@ private:
 		barrier.subresourceRange.baseMipLevel = 0;
 		barrier.subresourceRange.levelCount = mipLevels; // mip levels
 		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.layerCount = layerCount; // array layers
 
 		VkPipelineStageFlags sourceStage;
 		VkPipelineStageFlags destinationStage;
@@ -1672,11 +2398,11 @@ private:
 			1, &barrier
 		);
 
-		endSingleTimeCommands(commandBuffer);
+		endUploadCommands();
 	}
 	// it creates a buffer based on the size required, the intended use of the buffer, and the properties of the memory
 	// last two parameters are the buffer and the memory object which are returned
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory)
 	{
 		// creating a buffer requires us to create VkBufferCreateInfo struct
 		VkBufferCreateInfo bufferInfo{};
@@ -1695,39 +2421,16 @@ private:
 		// give our buffer what kind of memory it needs
 		vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size; // size of required memory in bytes
-		// bitmask, Bit i is set iff the memory type i is supported
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		// device that owns the memory, allocation info like memory type and size, handle to store the memory
-		if (vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate vertex buffer memory!");
-		}
-
-		// link the buffer with actual raw memory
-		vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
-	}
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-		// what kinds of memory does our GPU offer
-		VkPhysicalDeviceMemoryProperties memProperties;
-		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		// a piece of one of the allocator's blocks (memory type bits, size and alignment come from the requirements)
+		bufferMemory = m_allocator.allocate(memRequirements, properties, MemoryResourceKind::Linear, false);
 
-		// find a memory type that is suitable for the buffer
-		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-			// is the memory type i suitable for the buffer and does it have the properties we want
-			if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-				return i;
-			}
-		}
+		// link the buffer with its place in the raw memory
+		vkBindBufferMemory(m_device, buffer, bufferMemory.memory, bufferMemory.offset);
 	}
 	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+		PROFILE_SCOPE("createDescriptorPool");
+		// one set per frame, with whatever the shaders declare
+		std::vector<VkDescriptorPoolSize> poolSizes = m_shaderInterface.poolSizes(static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1741,6 +2444,7 @@ private:
 	}
 	void createDescriptorSets()
 	{
+		PROFILE_SCOPE("createDescriptorSets");
 		// array of descriptor set layout
 		std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
 
@@ -1757,42 +2461,53 @@ private:
 			throw std::runtime_error("failed to allocate descriptor sets!");
 		}
 
+		// the shaders' names for what goes into the sets, the bindings are wherever they declared them
+		const ReflectedBinding* uboBinding = m_shaderInterface.find("ubo");
+		const ReflectedBinding* samplerBinding = m_shaderInterface.find("texSampler");
+		if (uboBinding == nullptr || samplerBinding == nullptr || m_shaderInterface.bindings.size() != 2) {
+			throw std::runtime_error("failed to create descriptor sets, the shaders have to declare ubo and texSampler (and nothing else)!");
+		}
+		VkDescriptorType uboType = enableDynamicUniformBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		if (uboBinding->type != uboType || uboBinding->size != sizeof(UniformBufferObject) ||
+			samplerBinding->type != VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || samplerBinding->count != MAX_TEXTURE_IMAGES) {
+			throw std::runtime_error("failed to create descriptor sets, ubo or texSampler changed type!");
+		}
+
 		// POOL -> LAYOUT -> SETS -> BINDING -> BUFFER -> MEMORY
 		// CONFIGURE EACH DESCRIPTOR SET
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			RingAllocation frameConstants = m_frameAllocator.frameConstants(static_cast<uint32_t>(i));
 			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = m_uniformBuffers[i];
-			bufferInfo.offset = 0;
+			bufferInfo.buffer = frameConstants.buffer;
+			bufferInfo.offset = frameConstants.offset; // the first object's, a dynamic offset picks the others
 			bufferInfo.range = sizeof(UniformBufferObject);
 
-			VkDescriptorImageInfo imageInfo{};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = m_textureImageView;
-			imageInfo.sampler = m_textureSampler;
+			std::array<VkDescriptorImageInfo, MAX_TEXTURE_IMAGES> imageInfos = textureImageInfos();
 
 			// VkWriteDescriptorSet descriptorWrite{};
 			std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
 			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 			descriptorWrites[0].dstSet = m_descriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstBinding = uboBinding->binding;
 			descriptorWrites[0].dstArrayElement = 0;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[0].descriptorType = uboType;
 			descriptorWrites[0].descriptorCount = 1;
 			descriptorWrites[0].pBufferInfo = &bufferInfo;
 
 			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 			descriptorWrites[1].dstSet = m_descriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
+			descriptorWrites[1].dstBinding = samplerBinding->binding;
 			descriptorWrites[1].dstArrayElement = 0;
 			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pImageInfo = &imageInfo;
+			descriptorWrites[1].descriptorCount = MAX_TEXTURE_IMAGES;
+			descriptorWrites[1].pImageInfo = imageInfos.data();
 
 			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 		}
 	}
 	void createCommandBuffers()
 	{
+		PROFILE_SCOPE("createCommandBuffers");
 		// resize the command buffer array to number of inflight frames allowed
 		m_commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
@@ -1806,9 +2521,15 @@ private:
 		if (vkAllocateCommandBuffers(m_device, &allocInfo, m_commandBuffers.data()) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
+
+		if (enableParallelRecording) {
+			QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+			m_parallelRecorder.init(m_device, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, m_jobs, RECORDING_THREAD_COUNT);
+		}
 	}
 
 	void createLogicalDevice() {
+		PROFILE_SCOPE("createLogicalDevice");
 		// queue family indices of the queues inside out physical device which as been selected
 		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
@@ -1816,6 +2537,9 @@ private:
 		// such as presentation, graphics, etc
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentationFamily.value() };
+		if (indices.transferFamily.has_value()) {
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
+		}
 
 		float queuePriority = 1.0f;
 		// for every unique element in the set of queue families
@@ -1844,8 +2568,37 @@ private:
 
 		// Enabling the required extensions on the logical device (its extensions count and names)
 		// isDeviceSuitable() already makes sure that these extensions are supported by our physical device
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		std::vector<const char*> enabledExtensions = deviceExtensions;
+
+		// timeline semaphores are optional, the GPU timeline falls back to fences without them
+		m_timelineSupport = GpuTimeline::querySupport(m_instance, m_instanceApiVersion, physicalDevice);
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+		if (m_timelineSupport != GpuTimelineSupport::None) {
+			createInfo.pNext = &timelineFeatures;
+		}
+		if (m_timelineSupport == GpuTimelineSupport::Extension) {
+			enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		}
+		// optional too, only needed to tell pipeline cache hits from misses
+		bool pipelineCreationFeedback = PersistentPipelineCache::supportsCreationFeedback(physicalDevice);
+		if (pipelineCreationFeedback) {
+			enabledExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+		}
+		// dynamic rendering is core in 1.3, older devices keep using the render pass
+		m_dynamicRendering = enableDynamicRendering && DynamicRendering::querySupport(m_instance, m_instanceApiVersion, physicalDevice);
+		if (m_dynamicRendering) {
+			m_dynamicRenderer.enable(createInfo);
+		}
+		// optional as well, without it every variant is compiled in full
+		m_graphicsPipelineLibrary = enableGraphicsPipelineLibrary &&
+			GraphicsPipelineLibrary::querySupport(m_instance, m_instanceApiVersion, physicalDevice);
+		if (m_graphicsPipelineLibrary) {
+			m_pipelineLibrary.enable(createInfo, enabledExtensions);
+		}
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 		// debugging
 		if (enableValidationLayers) {
@@ -1863,15 +2616,44 @@ private:
 		vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 		// call to retrieve the queue handle of presentation queue (we already know the index)
 		vkGetDeviceQueue(m_device, indices.presentationFamily.value(), 0, &presentationQueue);
+		// uploads share the graphics queue if there is no transfer queue
+		if (indices.transferFamily.has_value()) {
+			vkGetDeviceQueue(m_device, indices.transferFamily.value(), 0, &m_transferQueue);
+		}
+		else {
+			m_transferQueue = graphicsQueue;
+		}
+		m_timeline.init(m_device, m_timelineSupport);
+		if (m_dynamicRendering) {
+			m_dynamicRenderer.init(m_device);
+		}
+		m_pipelineCache.init(m_device, physicalDevice, PIPELINE_CACHE_PATH, pipelineCreationFeedback);
+		m_layouts.init(m_device);
+		m_pipelines.init(m_device, m_jobs, [this](const GraphicsPipelineDesc& desc) {
+			return m_graphicsPipelineLibrary ? m_pipelineLibrary.link(desc, false) : buildGraphicsPipeline(desc);
+		});
+		if (m_graphicsPipelineLibrary) {
+			m_pipelineLibrary.init(m_device, m_pipelineCache.handle(), [this](const GraphicsPipelineDesc& desc, VkGraphicsPipelineLibraryFlagsEXT part) {
+				return buildGraphicsPipeline(desc, part);
+			});
+			// the quickly linked pipeline draws until the link time optimized one is ready
+			m_pipelines.enableOptimization([this](const GraphicsPipelineDesc& desc) { return m_pipelineLibrary.link(desc, true); });
+		}
+#ifdef ENABLE_SHADER_HOT_RELOAD
+		m_shaderHotReload.init(m_jobs, {
+			{ "shaders/shader.vert", "shaders/vert.spv", shaderc_vertex_shader },
+			{ "shaders/shader_mvp.vert", "shaders/mvp_vert.spv", shaderc_vertex_shader },
+			{ "shaders/shader.frag", "shaders/frag.spv", shaderc_fragment_shader } });
+#endif
 	}
 	// take raw shader bytecode and create a shader module (basically wrap it)
-	VkShaderModule createShaderModule(const std::vector<char>& code)
+	VkShaderModule createShaderModule(const SpirvCode& code)
 	{
 		VkShaderModuleCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		// reinterpret cast basically changes the type of the pointer
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		createInfo.codeSize = code.size(); // in bytes
+		// already 32 bit words, no cast (or alignment worries) needed
+		createInfo.pCode = code.words;
 
 		VkShaderModule shaderModule;
 		if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -1897,11 +2679,26 @@ private:
 			throw std::runtime_error("failed to begin recording command buffer!");
 		}
 
+		// the images this frame renders to, with dynamic rendering
+		DynamicRenderTarget target;
+		if (m_dynamicRendering) {
+			target.colorImage = m_colorImage;
+			target.colorView = m_colorImageView;
+			target.depthImage = m_depthImage;
+			target.depthView = m_depthImageView;
+			target.depthAspects = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(findDepthFormat()) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+			target.presentImage = m_swapChainImages[imageIndex];
+			target.presentView = m_swapChainImageViews[imageIndex];
+			target.extent = m_swapChainExtent;
+			target.clearColor = clearValues[0];
+			target.clearDepth = clearValues[1];
+		}
+
 		// start a render pass
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = m_renderPass;
-		renderPassInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
+		renderPassInfo.framebuffer = m_dynamicRendering ? VK_NULL_HANDLE : m_swapChainFramebuffers[imageIndex];
 
 		renderPassInfo.renderArea.offset = { 0, 0 };
 		renderPassInfo.renderArea.extent = m_swapChainExtent;
@@ -1913,10 +2710,134 @@ private:
 			renderPassInfo.clearValueCount = 1;
 			renderPassInfo.pClearValues = &clearColor;*/
 
+		if (m_dynamicRendering) {
+			m_dynamicRenderer.begin(commandBuffer, target, enableParallelRecording ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0);
+		}
+		else {
 			// begin the render pass
-		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+				enableParallelRecording ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+		}
+
+		if (enableParallelRecording) {
+			// the draws are recorded into secondary command buffers on several threads
+			VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+			const std::vector<VkCommandBuffer>& secondaries = m_parallelRecorder.record(currentFrame,
+				drawInheritance(imageIndex, renderingInheritance), m_drawCount,
+				[this](VkCommandBuffer secondary, uint32_t firstDraw, uint32_t drawCount) { recordDraws(secondary, firstDraw, drawCount); });
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		}
+		else {
+			recordDraws(commandBuffer, 0, m_drawCount);
+		}
+
+		// end the render pass
+		if (m_dynamicRendering) {
+			m_dynamicRenderer.end(commandBuffer, target);
+		}
+		else {
+			vkCmdEndRenderPass(commandBuffer);
+		}
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+		// end recording the command buffer
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+
+	// what secondary command buffers with draws for imageIndex inherit: the render pass and framebuffer,
+	// or the attachment formats with dynamic rendering (rendering has to outlive the result)
+	VkCommandBufferInheritanceInfo drawInheritance(uint32_t imageIndex, VkCommandBufferInheritanceRenderingInfo& rendering)
+	{
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		if (!m_dynamicRendering) {
+			inheritanceInfo.renderPass = m_renderPass;
+			inheritanceInfo.subpass = 0;
+			inheritanceInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
+			return inheritanceInfo;
+		}
+		rendering = VkCommandBufferInheritanceRenderingInfo{};
+		rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		rendering.colorAttachmentCount = 1;
+		rendering.pColorAttachmentFormats = &m_swapChainImageFormat;
+		rendering.depthAttachmentFormat = findDepthFormat();
+		rendering.rasterizationSamples = m_msaaSamples;
+		inheritanceInfo.pNext = &rendering;
+		return inheritanceInfo;
+	}
+
+	// the command buffer for imageIndex and frame, (re-)recorded if it is older than the scene
+	// its previous submission belonged to the same frame in flight, so it has finished by now
+	VkCommandBuffer cachedCommandBuffer(uint32_t imageIndex, uint32_t frame)
+	{
+		// the number of swap chain images can change on resize, the cache only grows
+		size_t pairCount = m_swapChainImages.size() * MAX_FRAMES_IN_FLIGHT;
+		if (m_cachedCommandBuffers.size() < pairCount) {
+			m_cachedCommandBuffers.resize(pairCount);
+		}
+		CachedCommandBuffer& cached = m_cachedCommandBuffers[imageIndex * MAX_FRAMES_IN_FLIGHT + frame];
+		if (cached.commandBuffer == VK_NULL_HANDLE) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = m_commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(m_device, &allocInfo, &cached.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+		}
+		if (cached.recordedGeneration != m_sceneGeneration) {
+			vkResetCommandBuffer(cached.commandBuffer, 0);
+			recordCommandBuffer(cached.commandBuffer, imageIndex);
+			cached.recordedGeneration = m_sceneGeneration;
+			m_commandBufferRecordings++;
+		}
+		return cached.commandBuffer;
+	}
+	// call whenever something the recorded commands refer to changes (framebuffers, pipeline, buffers, draw list)
+	void invalidateRecordedCommands()
+	{
+		m_sceneGeneration++;
+	}
+
+	// binds the pipeline state and records draws [firstDraw, firstDraw + drawCount) of the draw list
+	// (called on recording threads for secondary command buffers, so it only reads application state)
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount) {
+		bindDrawState(commandBuffer);
+
+		// bind the descriptor sets, with a dynamic uniform buffer every draw binds the set again at its object's offset
+		// (shader_mvp.vert does not read the uniform buffer, a dynamic one still needs an offset)
+		bool dynamicOffsetPerDraw = enableDynamicUniformBuffer && !m_pushTransforms;
+		if (!dynamicOffsetPerDraw) {
+			uint32_t dynamicOffset = 0;
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame],
+				enableDynamicUniformBuffer ? 1 : 0, &dynamicOffset);
+		}
+
+		// actual draw calls
+		// vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+		for (uint32_t draw = firstDraw; draw < firstDraw + drawCount; draw++) {
+			// every draw is the same object for now, a draw list with several would push the transform of each
+			if (m_pushTransforms) {
+				vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ObjectTransform), &m_objectTransform);
+			}
+			else if (dynamicOffsetPerDraw) {
+				uint32_t dynamicOffset = objectConstantsOffset(draw);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame],
+					1, &dynamicOffset);
+			}
+			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(m_indices.size()), 1, 0, 0, 0);
+		}
+	}
+	// where the uniform buffer of the object drawn by draw starts, relative to the frame's constants
+	uint32_t objectConstantsOffset(uint32_t draw) const
+	{
+		return static_cast<uint32_t>((draw % MAX_OBJECTS) * m_objectConstantsStride);
+	}
+	// pipeline, vertex and index buffers, viewport and scissor, everything a draw needs but its descriptors and constants
+	void bindDrawState(VkCommandBuffer commandBuffer) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_boundPipeline);
 
 		VkBuffer vertexBuffers[] = { m_vertexBuffer };
 		VkDeviceSize offsets[] = { 0 };
@@ -1942,53 +2863,140 @@ private:
 		scissor.offset = { 0, 0 };
 		scissor.extent = m_swapChainExtent;
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-		// bind the descriptor sets
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame], 0, nullptr);
-
-		// actual draw call
-		// vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(m_indices.size()), 1, 0, 0, 0);
-
-		// end the render pass
-		vkCmdEndRenderPass(commandBuffer);
-
-		// end recording the command buffer
-		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-			throw std::runtime_error("failed to record command buffer!");
-		}
 	}
 
 	void createSyncObjects() {
+		PROFILE_SCOPE("createSyncObjects");
 		// resize the vectors to hold the semaphores and fences
 		m_imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 		m_renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		m_inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+		// no frame has been submitted yet, value 0 counts as reached [Green Light]
+		m_frameTimelineValues.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
 		// create a semaphore info struct
 		VkSemaphoreCreateInfo semaphoreInfo{};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		// create a fence info struct
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // set the fence to be signaled at creation [Green Light]
-
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 		{
 			if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]) != VK_SUCCESS ||
-				vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i]) != VK_SUCCESS ||
-				vkCreateFence(m_device, &fenceInfo, nullptr, &m_inFlightFences[i]) != VK_SUCCESS)
+				vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i]) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create synchronization objects for a frame!");
 			}
 		}
 	}
 
-	void drawFrame()
+#ifdef ENABLE_SHADER_HOT_RELOAD
+	// swaps in the pipelines built from the recompiled shaders once all of them are ready, until then the old ones keep drawing
+	void updateShaders()
+	{
+		uint64_t revision = m_shaderHotReload.poll();
+		if (revision <= m_defaultPipelineDesc.shaderRevision) {
+			return;
+		}
+		GraphicsPipelineDesc defaultDesc = m_defaultPipelineDesc;
+		defaultDesc.shaderRevision = revision;
+		GraphicsPipelineDesc sceneDesc = m_scenePipelineDesc;
+		sceneDesc.shaderRevision = revision;
+		VkPipeline defaultPipeline = m_pipelines.request(defaultDesc);
+		VkPipeline scenePipeline = m_pipelines.request(sceneDesc);
+		if (defaultPipeline == VK_NULL_HANDLE || scenePipeline == VK_NULL_HANDLE) {
+			return;
+		}
+
+		// frames already submitted may still use the old pipelines
+		uint64_t lastUse = m_timeline.submittedValue();
+		for (const GraphicsPipelineDesc* oldDesc : { &m_defaultPipelineDesc, &m_scenePipelineDesc }) {
+			VkPipeline oldPipeline = m_pipelines.remove(*oldDesc);
+			if (oldPipeline != VK_NULL_HANDLE) {
+				m_deletionQueue.retirePipeline(oldPipeline, lastUse);
+			}
+		}
+		m_graphicsPipeline = defaultPipeline;
+		m_defaultPipelineDesc.shaderRevision = revision;
+		m_scenePipelineDesc.shaderRevision = revision;
+		// nothing links from the older shaders anymore, their library parts follow the pipelines (see drawFrame)
+		if (m_graphicsPipelineLibrary) {
+			m_pipelineLibrary.retireShaderRevisions(revision);
+		}
+
+		// how the old shaders did, to compare with the frames which follow
+		auto now = std::chrono::high_resolution_clock::now();
+		uint64_t frames = m_drawnFrames - m_framesAtShaderSwap;
+		if (frames > 0) {
+			double seconds = std::chrono::duration<double>(now - m_shaderSwapTime).count();
+			std::cout << "shaders before revision " << revision << ": " << frames << " frames, " << frames / seconds << " fps, CPU draw "
+				<< (m_drawTotalMicroseconds - m_drawMicrosecondsAtShaderSwap) / frames / 1000.0 << " ms per frame\n";
+		}
+		m_framesAtShaderSwap = m_drawnFrames;
+		m_drawMicrosecondsAtShaderSwap = m_drawTotalMicroseconds;
+		m_shaderSwapTime = now;
+	}
+#endif
+
+	// true if desc's vertex shader takes its transform as a push constant (shader_mvp.vert)
+	static bool pushesTransforms(const GraphicsPipelineDesc& desc)
 	{
-		// wait for the fence to be signaled [Green light that previous frame has finished and new frame rendering can begin]
-		vkWaitForFences(m_device, 1, &m_inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+		return desc.vertexShader == "shaders/mvp_vert.spv";
+	}
+
+	// what the frame benchmarks measure
+	FrameCounters frameCounters() const
+	{
+		FrameCounters counters;
+		counters.drawnFrames = m_drawnFrames;
+		counters.updateMicroseconds = m_updateTotalMicroseconds;
+		counters.recordMicroseconds = m_recordTotalMicroseconds;
+		counters.commandBufferRecordings = m_commandBufferRecordings;
+		return counters;
+	}
+
+	void drawFrame(const FramePacket& packet)
+	{
+		// wait for the timeline to reach the last submission of this frame [Green light that previous frame has finished and new frame rendering can begin]
+		m_timeline.wait(m_frameTimelineValues[currentFrame]);
+		// the GPU is done with this frame's transient data, its ring region can be filled again
+		m_frameAllocator.beginFrame(currentFrame, m_timeline.completedValue());
+		// destroy whatever was retired by frames which have finished by now
+		m_deletionQueue.collect(m_timeline.completedValue());
+		// optimized pipelines have replaced the quickly linked ones, frames already submitted may still use those
+		for (VkPipeline replaced : m_pipelines.takeReplaced()) {
+			m_deletionQueue.retirePipeline(replaced, m_timeline.submittedValue());
+		}
+		// library parts of shader revisions which have been swapped out, once the links still running with them are done
+		if (m_graphicsPipelineLibrary) {
+			for (VkPipeline part : m_pipelineLibrary.takeRetired()) {
+				m_deletionQueue.retirePipeline(part, m_timeline.submittedValue());
+			}
+		}
+		VkPipeline defaultPipeline = m_pipelines.request(m_defaultPipelineDesc);
+		if (defaultPipeline != VK_NULL_HANDLE) {
+			m_graphicsPipeline = defaultPipeline;
+		}
+#ifdef ENABLE_SHADER_HOT_RELOAD
+		updateShaders();
+#endif
+		if (enablePermutationBenchmark) {
+			m_permutationBenchmark.step(frameCounters(), m_scenePipelineDesc, m_pipelines);
+		}
+		if (enableTransformBenchmark) {
+			m_transformBenchmark.step(frameCounters(), m_scenePipelineDesc, m_pipelines);
+		}
+		// draw with the scene's pipeline variant once it has been compiled, with the default pipeline until then
+		VkPipeline scenePipeline = m_pipelines.request(m_scenePipelineDesc);
+		bool pushTransforms = pushesTransforms(m_scenePipelineDesc);
+		if (scenePipeline == VK_NULL_HANDLE) {
+			scenePipeline = m_graphicsPipeline;
+			pushTransforms = pushesTransforms(m_defaultPipelineDesc);
+		}
+		if (scenePipeline != m_boundPipeline || pushTransforms != m_pushTransforms) {
+			m_boundPipeline = scenePipeline;
+			m_pushTransforms = pushTransforms;
+			invalidateRecordedCommands();
+		}
+		// pushed transforms are recorded into the command buffers, so they have to be known before recording
+		updateUniformBuffer(currentFrame, packet);
 
 		uint32_t imageIndex;
 		// acquire an image from the swap chain, when done, signal the semaphore ON
@@ -2007,17 +3015,24 @@ private:
 			throw std::runtime_error("failed to acquire swap chain image!");
 		}
 
-		// Switch on Red light for the fence
-		vkResetFences(m_device, 1, &m_inFlightFences[currentFrame]);
-
 		// now let us render to this image
 		// we need to specify which command buffer to use for this image
-		// we can use the image index to select the command buffer
-		vkResetCommandBuffer(m_commandBuffers[currentFrame], 0);
-		// begin recording the command buffer
-		recordCommandBuffer(m_commandBuffers[currentFrame], imageIndex);
-		// update the uniform buffer (MVP matrix)
-		updateUniformBuffer(currentFrame);
+		auto recordBegin = std::chrono::high_resolution_clock::now();
+		VkCommandBuffer commandBuffer;
+		if (enableCommandBufferCache && !enableParallelRecording) {
+			// reused as is unless the scene changed since it was recorded
+			commandBuffer = cachedCommandBuffer(imageIndex, currentFrame);
+		}
+		else {
+			// we can use the frame index to select the command buffer
+			commandBuffer = m_commandBuffers[currentFrame];
+			vkResetCommandBuffer(commandBuffer, 0);
+			// begin recording the command buffer
+			recordCommandBuffer(commandBuffer, imageIndex);
+			m_commandBufferRecordings++;
+		}
+		m_recordTotalMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - recordBegin).count();
+		m_recordedFrames++;
 
 		// submit the command buffer to the graphics queue
 		// we need to specify which semaphores to wait on before execution and which to signal when execution is done
@@ -2031,7 +3046,7 @@ private:
 		submitInfo.pWaitDstStageMask = waitStages;
 		// submit the command buffer
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &m_commandBuffers[currentFrame];
+		submitInfo.pCommandBuffers = &commandBuffer;
 
 		// signal the render finished semaphore when done
 		VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[currentFrame] }; // signal them when done
@@ -2039,11 +3054,9 @@ private:
 		submitInfo.pSignalSemaphores = signalSemaphores;
 
 		// submit the command buffer to the graphics queue
-		// m_inFlightFence will be GREEN when all submitted command buffers have finished execution
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, m_inFlightFences[currentFrame]) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to submit draw command buffer!");
-		}
+		// the timeline reaches the returned value when all submitted command buffers have finished execution
+		m_frameTimelineValues[currentFrame] = m_timeline.submit(graphicsQueue, submitInfo);
+		m_frameAllocator.endFrame(m_frameTimelineValues[currentFrame]);
 
 		// now we need to present the rendered image to the screen
 		VkPresentInfoKHR presentInfo{};
@@ -2070,6 +3083,9 @@ private:
 		else if (result != VK_SUCCESS) {
 			throw std::runtime_error("failed to present swap chain image!");
 		}
+		// the next frame uses the other timeline value, ring region, command buffers and semaphores,
+		// so it is recorded while the GPU still works on this one
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 	}
 
 	/// <summary>
@@ -2077,47 +3093,96 @@ private:
 	/// </summary>
 	void cleanup()
 	{
-		// destroy the swap chain
-		cleanupSwapChain();
-
-		vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
-		// delete the pipeline layout (uniforms)
-		vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		// destroy the swap chain (the device is idle, so nothing has to wait)
+		cleanupSwapChain(m_timeline.submittedValue());
+		m_deletionQueue.printStats(std::cout);
+		m_deletionQueue.flush();
+		if (m_recordedFrames > 0) {
+			std::cout << "command recording (cache " << (enableCommandBufferCache ? "on" : "off") << "): "
+				<< m_recordTotalMicroseconds / m_recordedFrames << " us per frame, " << m_commandBufferRecordings
+				<< " command buffers recorded in " << m_recordedFrames << " frames\n";
+		}
+		if (m_updatedFrames > 0) {
+			std::cout << "transform update (" << (enablePushConstantTransforms ? "push constants" : "uniform buffer") << "): "
+				<< m_updateTotalMicroseconds / m_updatedFrames << " us per frame";
+			if (m_transformInvalidations > 0) {
+				// what pushing cost on top: every one of these frames recorded its command buffer again
+				std::cout << ", " << m_transformInvalidations << " of " << m_updatedFrames << " frames re-recorded because the pushed MVP changed";
+			}
+			std::cout << "\n";
+		}
+		if (m_swapChainRecreations > 0) {
+			std::cout << "resize hitch (" << (enableIncrementalSwapChainRecreation ? "incremental" : "full rebuild") << "): "
+				<< m_swapChainRecreations << " swap chain recreations, average " << m_resizeHitchTotalMilliseconds / m_swapChainRecreations
+				<< " ms, worst " << m_resizeHitchWorstMilliseconds << " ms\n";
+		}
+
+#ifdef ENABLE_SHADER_HOT_RELOAD
+		m_shaderHotReload.printStats(std::cout);
+		m_shaderHotReload.destroy();
+#endif
+		// destroy every pipeline variant (the default pipeline included)
+		m_pipelines.printStats(std::cout);
+		m_pipelines.destroy();
+		// the linked pipelines are gone, the parts they were linked from can go too
+		if (m_graphicsPipelineLibrary) {
+			m_pipelineLibrary.printStats(std::cout);
+			m_pipelineLibrary.destroy();
+		}
 		// delete the render pass object
 		vkDestroyRenderPass(m_device, m_renderPass, nullptr);
 
 		// delete the vertex buffer and its memory
 		vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
-		vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
+		m_allocator.free(m_indexBufferMemory);
 
 		// delete the vertex buffer and its memory
 		vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
-		vkFreeMemory(m_device, m_vertexBufferMemory, nullptr);
+		m_allocator.free(m_vertexBufferMemory);
 
-		// delete all uniform buffers stuff
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		// delete the per frame transient data (uniform buffers included)
+		m_frameAllocator.printStats(std::cout);
+		m_frameAllocator.destroy();
+		vkDestroySampler(m_device, m_textureSampler, nullptr);
+		for (TextureImage& texture : m_textureImages)
 		{
-			vkDestroyBuffer(m_device, m_uniformBuffers[i], nullptr);
-			vkFreeMemory(m_device, m_uniformBuffersMemory[i], nullptr);
+			vkDestroyImageView(m_device, texture.view, nullptr);
+			vkDestroyImage(m_device, texture.image, nullptr);
+			m_allocator.free(texture.memory);
 		}
-		vkDestroySampler(m_device, m_textureSampler, nullptr);
-		vkDestroyImageView(m_device, m_textureImageView, nullptr);
-		vkDestroyImage(m_device, m_textureImage, nullptr);
-		vkFreeMemory(m_device, m_textureImageMemory, nullptr);
+		m_textureImages.clear();
 
 		vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
-		vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+		// delete the descriptor set and pipeline layouts
+		m_layouts.printStats(std::cout);
+		m_layouts.destroy();
 
 		// delete the semaphores and fence
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 		{
 			vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
 			vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
-			vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
 		}
 
+		// delete the upload resources
+		m_uploads.printStats(std::cout);
+		m_uploads.destroy();
+		m_stagingPool.printStats(std::cout);
+		m_stagingPool.destroy();
+		m_timeline.printStats(std::cout);
+		m_timeline.destroy();
+		// write the pipeline cache for the next launch
+		m_pipelineCache.printStats(std::cout);
+		m_pipelineCache.destroy();
+
+		if (enableParallelRecording) {
+			m_parallelRecorder.destroy();
+		}
 		// delete the graphics command pool
 		vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+		// give the memory blocks back
+		m_allocator.printStats(std::cout);
+		m_allocator.destroy();
 		// delete the logical device
 		vkDestroyDevice(m_device, nullptr);
 
@@ -2129,80 +3194,149 @@ private:
 		vkDestroyInstance(m_instance, nullptr);
 		glfwDestroyWindow(m_window);
 		glfwTerminate();
+
+		m_jobs.printStats(std::cout);
+		m_jobs.destroy();
 	}
 
 	void recreateSwapChain()
 	{
 		int width = 0, height = 0;
-		glfwGetFramebufferSize(m_window, &width, &height);
+		framebufferSize(width, height);
 		while (width == 0 || height == 0) {
-			glfwGetFramebufferSize(m_window, &width, &height);
-			glfwWaitEvents();
+			if (enableRenderThread) {
+				// minimized, the main thread keeps handling the events until the window is back
+				if (m_renderThreadQuit) return;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			else {
+				glfwWaitEvents();
+			}
+			framebufferSize(width, height);
+		}
+		auto hitchBegin = std::chrono::high_resolution_clock::now();
+		// no vkDeviceWaitIdle, everything the old swap chain used is retired with the value of the last frame submitted
+		uint64_t lastUse = m_timeline.submittedValue();
+		if (enableIncrementalSwapChainRecreation) {
+			// the frames in flight keep rendering to the old framebuffers and presenting the old swap chain images
+			VkSwapchainKHR oldSwapChain = m_swapChain;
+			for (VkFramebuffer framebuffer : m_swapChainFramebuffers) {
+				m_deletionQueue.retireFramebuffer(framebuffer, lastUse);
+			}
+			for (VkImageView imageView : m_swapChainImageViews) {
+				m_deletionQueue.retireImageView(imageView, lastUse);
+			}
+			createSwapChain(oldSwapChain);
+			m_deletionQueue.retireSwapchain(oldSwapChain, lastUse);
+			createImageViews();
+			// the multisampled color and depth images are only replaced if the swap chain outgrew them
+			if (m_swapChainExtent.width > m_renderTargetExtent.width || m_swapChainExtent.height > m_renderTargetExtent.height ||
+				m_swapChainImageFormat != m_renderTargetFormat) {
+				retireRenderTargets(lastUse);
+				m_renderTargetExtent.width = std::max(m_renderTargetExtent.width, m_swapChainExtent.width);
+				m_renderTargetExtent.height = std::max(m_renderTargetExtent.height, m_swapChainExtent.height);
+				createColorReasources();
+				createDepthResources();
+			}
+			createFramebuffers();
+			// nothing above waited for the GPU, which is what the old vkDeviceWaitIdle did
+			m_deletionQueue.countAvoidedIdleStall();
 		}
-		vkDeviceWaitIdle(m_device);
-		cleanupSwapChain();
-		createSwapChain();
-		createImageViews();
-		createColorReasources();
-		createDepthResources();
-		createFramebuffers();
+		else {
+			cleanupSwapChain(lastUse);
+			// a window can only have one swap chain, the old one has to be gone before the new one is created,
+			// that only needs the frames to finish (not the transfer queue or anything else)
+			m_timeline.wait(lastUse);
+			m_deletionQueue.collect(m_timeline.completedValue());
+			createSwapChain(VK_NULL_HANDLE);
+			createImageViews();
+			m_renderTargetExtent = m_swapChainExtent;
+			createColorReasources();
+			createDepthResources();
+			createFramebuffers();
+		}
+		// the cached command buffers point at the old framebuffers and extent
+		invalidateRecordedCommands();
+
+		double hitchMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - hitchBegin).count();
+		m_swapChainRecreations++;
+		m_resizeHitchTotalMilliseconds += hitchMilliseconds;
+		m_resizeHitchWorstMilliseconds = std::max(m_resizeHitchWorstMilliseconds, hitchMilliseconds);
+	}
+	// the multisampled color and depth images
+	void retireRenderTargets(uint64_t lastUse)
+	{
+		m_deletionQueue.retireImageView(m_colorImageView, lastUse);
+		m_deletionQueue.retireImage(m_colorImage, m_colorImageMemory, lastUse);
+		m_deletionQueue.retireImageView(m_depthImageView, lastUse);
+		m_deletionQueue.retireImage(m_depthImage, m_depthImageMemory, lastUse);
 	}
-	void cleanupSwapChain()
+	// hands everything that depends on the swap chain to the deletion queue, lastUse is the value of the last frame which used it
+	void cleanupSwapChain(uint64_t lastUse)
 	{	
-		// delete the multi sampling buffer resources
-		vkDestroyImageView(m_device, m_colorImageView, nullptr);
-		vkDestroyImage(m_device, m_colorImage, nullptr);
-		vkFreeMemory(m_device, m_colorImageMemory, nullptr);
+		// delete the multi sampling buffer and depth buffer resources
+		retireRenderTargets(lastUse);
 
 		// delete all the frame buffers associated with every swpachain image
 		for (auto framebuffer : m_swapChainFramebuffers)
 		{
-			vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+			m_deletionQueue.retireFramebuffer(framebuffer, lastUse);
 		}
 
 		// delete all swap chain image views
 		for (auto imageView : m_swapChainImageViews) {
-			vkDestroyImageView(m_device, imageView, nullptr);
+			m_deletionQueue.retireImageView(imageView, lastUse);
 		}
-		// destroy depth buffer stuff
-		vkDestroyImageView(m_device, m_depthImageView, nullptr);
-		vkDestroyImage(m_device, m_depthImage, nullptr);
-		vkFreeMemory(m_device, m_depthImageMemory, nullptr);
-
 		// delete the swap chain itself
-		vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+		m_deletionQueue.retireSwapchain(m_swapChain, lastUse);
 	}
 
-	void updateUniformBuffer(uint32_t currentImage)
+	void updateUniformBuffer(uint32_t currentImage, const FramePacket& packet)
 	{
-		// update happen independent of frame rate
-		static auto startTime = std::chrono::high_resolution_clock::now();
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float timeElapsed = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-
-		UniformBufferObject ubo{};
-		ubo.model = glm::rotate(glm::mat4(1.0f), timeElapsed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)); // rotate 90 degrees per second around z axis
-		ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), // camera position
-			glm::vec3(0.0f, 0.0f, 0.0f), // look at origin
-			glm::vec3(0.0f, 0.0f, 1.0f)); // up vector
-		ubo.proj = glm::perspective(glm::radians(45.0f), // field of view
+		auto updateBegin = std::chrono::high_resolution_clock::now();
+		// model and camera come from the simulation, the projection depends on the swap chain the render thread owns
+		glm::mat4 proj = glm::perspective(glm::radians(45.0f), // field of view
 			m_swapChainExtent.width / (float)m_swapChainExtent.height, // aspect ratio
 			0.1f, // near plane
 			10.0f); // far plane
-		ubo.proj[1][1] *= -1;
-
-		// copy the updated MVP matrix to the uniform buffer memory
-		memcpy(m_uniformBuffersData[currentImage], &ubo, sizeof(ubo));
+		proj[1][1] *= -1;
+
+		if (m_pushTransforms) {
+			// multiplied once here instead of for every vertex, the uniform buffer is not read by shader_mvp.vert
+			// the recorded commands hold the matrix, so a moving object costs a recording every frame (even with the cache)
+			glm::mat4 mvp = proj * packet.view * packet.model;
+			if (mvp != m_objectTransform.mvp) {
+				m_objectTransform.mvp = mvp;
+				invalidateRecordedCommands();
+				m_transformInvalidations++;
+			}
+		}
+		else {
+			UniformBufferObject ubo{};
+			ubo.model = packet.model;
+			ubo.view = packet.view;
+			ubo.proj = proj;
+			// copy the updated MVP matrix to the uniform buffer memory, into the slot of every object drawn
+			// (they are all the same object for now)
+			char* constants = static_cast<char*>(m_frameAllocator.frameConstants(currentImage).data);
+			uint32_t objectCount = enableDynamicUniformBuffer ? std::min(m_drawCount, MAX_OBJECTS) : 1;
+			for (uint32_t object = 0; object < objectCount; object++) {
+				copyToMapped(constants + objectConstantsOffset(object), &ubo, sizeof(ubo));
+			}
+		}
+		m_updateTotalMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - updateBegin).count();
+		m_updatedFrames++;
 	}
-	void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texHeight, int32_t texWidth, uint32_t mipLevels)
+	void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, uint32_t layerCount)
 	{	
+		PROFILE_SCOPE("generateMipmaps");
 		VkFormatProperties formatProperties;
 		vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
 		if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
 		{
 			throw std::runtime_error("texture image format does not support linear blitting");
 		}
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		VkCommandBuffer commandBuffer = beginGraphicsUploadCommands();
 
 		// for each mip level these properties are same
 		VkImageMemoryBarrier barrier{};
@@ -2211,8 +3345,8 @@ private:
 		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; // not transferring queue family ownership
 		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; // not transferring queue family ownership
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseArrayLayer = 0; // not an array
-		barrier.subresourceRange.layerCount = 1; // not an array
+		barrier.subresourceRange.baseArrayLayer = 0; // all layers at once
+		barrier.subresourceRange.layerCount = layerCount;
 		barrier.subresourceRange.levelCount = 1; // only one mip level
 
 		int32_t mipWidth = texWidth;
@@ -2220,7 +3354,7 @@ private:
 
 		// properties that are variable
 		// start at 1 because the base image is already created
-		for (uint32_t i = 1; i < m_mipLevels; i++)
+		for (uint32_t i = 1; i < mipLevels; i++)
 		{
 			// transition previous mip level to transfer source layout
 			barrier.subresourceRange.baseMipLevel = i - 1;
@@ -2246,15 +3380,15 @@ private:
 			blit.srcOffsets[1] = { mipWidth, mipHeight, 1 }; // end at width, height, 1
 			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			blit.srcSubresource.mipLevel = i - 1; // source mip level
-			blit.srcSubresource.baseArrayLayer = 0; // not an array
-			blit.srcSubresource.layerCount = 1; // not an array
+			blit.srcSubresource.baseArrayLayer = 0; // every layer is blitted at once
+			blit.srcSubresource.layerCount = layerCount;
 			blit.dstOffsets[0] = { 0, 0, 0 }; // start at 0, 0, 0
 			blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 }; 
 			// end at width, height, 1
 			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			blit.dstSubresource.mipLevel = i; // destination mip level
-			blit.dstSubresource.baseArrayLayer = 0; // not an array
-			blit.dstSubresource.layerCount = 1; // not an array
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = layerCount;
 
 			// copy the previous mip level to the next mip level
 			vkCmdBlitImage(commandBuffer,
@@ -2289,7 +3423,7 @@ private:
 			0, nullptr,
 			1, &barrier);
 
-		endSingleTimeCommands(commandBuffer);
+		endUploadCommands();
 
 
 
@@ -2317,12 +3451,14 @@ private:
 	}
 	void createColorReasources()
 	{
+		PROFILE_SCOPE("createColorReasources");
 		VkFormat colorFormat = m_swapChainImageFormat;
+		m_renderTargetFormat = colorFormat;
 
-		createImage(m_swapChainExtent.width, m_swapChainExtent.height, colorFormat, VK_IMAGE_TILING_OPTIMAL,
+		createImage(m_renderTargetExtent.width, m_renderTargetExtent.height, colorFormat, VK_IMAGE_TILING_OPTIMAL,
 						VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-						m_colorImage, m_colorImageMemory, 1, m_msaaSamples);
-		m_colorImageView = createImageView(m_colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+						m_colorImage, m_colorImageMemory, 1, m_msaaSamples, 1);
+		m_colorImageView = createImageView(m_colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
 	}
 };
 
@@ -1,3 +1,33 @@
-C:/VulkanSDK/1.3.239.0/Bin/glslc.exe shader.vert -o vert.spv
-C:/VulkanSDK/1.3.239.0/Bin/glslc.exe shader.frag -o frag.spv
-pause
\ No newline at end of file
+@echo off
+rem compiles every shader to SPIR-V (name.spv) and to the same words as a C initializer list (name.spv.inc, embedded by
+rem EmbeddedShaders.h) and validates the result, stops at the first shader which fails
+rem the project runs it for every shader whose source is newer than its outputs, running it by hand is only needed outside
+rem of Visual Studio
+rem   compiler.bat                    every shader
+rem   compiler.bat shader.frag frag   one shader, the output name comes without .spv
+setlocal
+cd /d "%~dp0"
+if not defined VULKAN_SDK set VULKAN_SDK=C:/VulkanSDK/1.3.239.0
+set GLSLC="%VULKAN_SDK%/Bin/glslc.exe"
+set SPIRV_VAL="%VULKAN_SDK%/Bin/spirv-val.exe"
+
+if not "%~1"=="" (
+	call :compile %1 %2 || exit /b 1
+	exit /b 0
+)
+call :compile shader.vert vert || goto failed
+call :compile shader.frag frag || goto failed
+call :compile shader_mvp.vert mvp_vert || goto failed
+pause
+exit /b 0
+
+:failed
+pause
+exit /b 1
+
+:compile
+%GLSLC% %1 -o %2.spv || exit /b 1
+%GLSLC% %1 -mfmt=num -o %2.spv.inc || exit /b 1
+%SPIRV_VAL% --target-env vulkan1.0 %2.spv || exit /b 1
+echo %1 -^> %2.spv, %2.spv.inc
+exit /b 0
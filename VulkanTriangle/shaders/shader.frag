@@ -2,9 +2,61 @@
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
-layout(binding = 1) uniform sampler2D texSampler;
+layout(location = 2) flat in vec4 fragTexRect;  // uv offset, uv scale of the texture in its packed image
+layout(location = 3) flat in uvec2 fragTexSlot; // packed image index, layer in it
+
+// every packed image the texture packer made, as an array (atlas pages and size class members are its layers), slots the
+// application has no image for repeat image 0
+const int MAX_TEXTURE_IMAGES = 4;
+layout(binding = 1) uniform sampler2DArray texSampler[MAX_TEXTURE_IMAGES];
 layout(location = 0) out vec4 outColor;
 
+// permutations, set per pipeline through specialization constants (the defaults are what every pipeline did before)
+// the driver folds the branches away, so a feature which is off costs nothing
+layout(constant_id = 0) const bool USE_VERTEX_COLOR = true;
+layout(constant_id = 1) const bool USE_TEXTURE = true;
+layout(constant_id = 2) const bool ALPHA_TEST = false;
+layout(constant_id = 3) const int TEXTURE_SAMPLES = 1; // taps averaged over the pixel's texture footprint
+
+// the model's uvs repeat the texture, the packed image holds it once, so wrap inside its rect here (the sampler clamps)
+// the gradients come from the unwrapped uvs, wrapping would make them jump at the seams
+vec4 samplePacked(vec2 uv, vec2 dx, vec2 dy) {
+    vec3 coord = vec3(fragTexRect.xy + fract(uv) * fragTexRect.zw, float(fragTexSlot.y));
+    dx *= fragTexRect.zw;
+    dy *= fragTexRect.zw;
+    // constant indices only, the flat input need not be the same over a draw and indexing the array with anything else
+    // needs shaderSampledImageArrayDynamicIndexing (one case per MAX_TEXTURE_IMAGES)
+    switch (fragTexSlot.x) {
+    case 1u: return textureGrad(texSampler[1], coord, dx, dy);
+    case 2u: return textureGrad(texSampler[2], coord, dx, dy);
+    case 3u: return textureGrad(texSampler[3], coord, dx, dy);
+    default: return textureGrad(texSampler[0], coord, dx, dy);
+    }
+}
+
 void main() {
-    outColor = vec4(fragColor * texture(texSampler, fragTexCoord).rgb, 1.0);
+    vec4 color = vec4(1.0);
+    if (USE_TEXTURE) {
+        vec2 dx = dFdx(fragTexCoord);
+        vec2 dy = dFdy(fragTexCoord);
+        if (TEXTURE_SAMPLES <= 1) {
+            color = samplePacked(fragTexCoord, dx, dy);
+        }
+        else {
+            // spread the taps along the diagonal of the footprint
+            vec2 footprint = dx + dy;
+            color = vec4(0.0);
+            for (int i = 0; i < TEXTURE_SAMPLES; i++) {
+                color += samplePacked(fragTexCoord + footprint * ((float(i) + 0.5) / float(TEXTURE_SAMPLES) - 0.5), dx, dy);
+            }
+            color /= float(TEXTURE_SAMPLES);
+        }
+    }
+    if (ALPHA_TEST && color.a < 0.5) {
+        discard;
+    }
+    if (USE_VERTEX_COLOR) {
+        color.rgb *= fragColor;
+    }
+    outColor = vec4(color.rgb, 1.0);
     }
\ No newline at end of file
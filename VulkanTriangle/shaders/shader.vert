@@ -4,9 +4,13 @@
 layout(location = 0) in vec3 in_Postion;
 layout(location = 1) in vec3 in_Color;
 layout(location = 2) in vec2 in_TexCoords;
+layout(location = 3) in vec4 in_TexRect;  // where the vertex's texture sits in its packed image: uv offset, uv scale
+layout(location = 4) in uvec2 in_TexSlot; // packed image index, layer in it
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out vec4 fragTexRect;
+layout(location = 3) flat out uvec2 fragTexSlot;
 
 layout(binding=0) uniform UniformBufferObject {
 	mat4 model;
@@ -19,4 +23,6 @@ void main() {
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(in_Postion, 1.0);  // (x,y,z, 1) homegenous
     fragColor = in_Color;
 	fragTexCoord = in_TexCoords;
+	fragTexRect = in_TexRect;
+	fragTexSlot = in_TexSlot;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include "MemoryAllocator.h"
+
+// random allocate/free sequences on a buddy allocator, throws as soon as an allocation is misaligned, overlaps another
+// one or the allocator's byte count disagrees with the live allocations, and checks that everything merges back into
+// one free block at the end (no GPU needed)
+inline void stressTestAllocator()
+{
+	const uint64_t blockSize = 16 * 1024 * 1024;
+	const uint64_t minNodeSize = 256;
+	const uint32_t rounds = 8;
+	const uint32_t operationsPerRound = 100000;
+	std::mt19937 random(1234);
+	uint64_t allocations = 0, failedAllocations = 0, frees = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t round = 0; round < rounds; round++) {
+		BuddyAllocator buddy(blockSize, minNodeSize);
+		struct Live { uint64_t size, nodeSize; };
+		std::map<uint64_t, Live> live; // offset -> allocation
+		std::vector<uint64_t> liveOffsets; // the same offsets, to free a random one
+		uint64_t usedBytes = 0;
+		// later rounds free less often, so the block fills up and allocations start to fail
+		uint32_t freePercent = 50 - round * 4;
+
+		for (uint32_t operation = 0; operation < operationsPerRound; operation++) {
+			if (!liveOffsets.empty() && random() % 100 < freePercent) {
+				size_t index = random() % liveOffsets.size();
+				uint64_t offset = liveOffsets[index];
+				liveOffsets[index] = liveOffsets.back();
+				liveOffsets.pop_back();
+				buddy.free(offset);
+				usedBytes -= live[offset].nodeSize;
+				live.erase(offset);
+				frees++;
+			}
+			else {
+				// mostly small sizes with the occasional large one, like buffers and images
+				uint64_t size = random() % 32 == 0 ? 1 + random() % (256 * 1024) : 1 + random() % (16 * 1024);
+				uint64_t alignment = uint64_t(1) << (random() % 13); // 1 to 4096
+				uint64_t offset = buddy.allocate(size, alignment);
+				if (offset == BuddyAllocator::INVALID_OFFSET) {
+					failedAllocations++;
+					continue;
+				}
+				allocations++;
+				if (offset % alignment != 0 || offset + size > blockSize) {
+					throw std::runtime_error("allocator stress test failed, allocation is misaligned or outside the block!");
+				}
+				// the allocations just below and above must end before it starts and start after it ends
+				auto next = live.lower_bound(offset);
+				if ((next != live.end() && next->first < offset + size) ||
+					(next != live.begin() && std::prev(next)->first + std::prev(next)->second.size > offset)) {
+					throw std::runtime_error("allocator stress test failed, allocations overlap!");
+				}
+				uint64_t nodeSize = minNodeSize;
+				while (nodeSize < std::max(size, alignment)) nodeSize <<= 1;
+				live[offset] = { size, nodeSize };
+				liveOffsets.push_back(offset);
+				usedBytes += nodeSize;
+			}
+			if (buddy.usedBytes() != usedBytes || buddy.allocationCount() != live.size()) {
+				throw std::runtime_error("allocator stress test failed, used bytes do not match the live allocations!");
+			}
+		}
+
+		for (uint64_t offset : liveOffsets) {
+			buddy.free(offset);
+			frees++;
+		}
+		if (!buddy.empty() || buddy.freeBytes() != blockSize || buddy.largestFreeNode() != blockSize) {
+			throw std::runtime_error("allocator stress test failed, the free nodes did not merge back into one block!");
+		}
+	}
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "allocator stress test: " << allocations << " allocations (" << failedAllocations << " did not fit), "
+		<< frees << " frees in " << rounds << " blocks, " << milliseconds << " ms\n";
+}
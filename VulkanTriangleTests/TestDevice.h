@@ -0,0 +1,135 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include "GpuTimeline.h"
+
+// a Vulkan device without a window or a surface for the tests which need a GPU, any driver with a graphics queue will do
+// (lavapipe included, it has a single queue family), the first such device is picked
+class TestDevice {
+public:
+	VkInstance instance = VK_NULL_HANDLE;
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t graphicsFamily = 0;
+	std::optional<uint32_t> transferFamily; // a transfer only family the way the application picks it, if there is one
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	VkQueue transferQueue = VK_NULL_HANDLE; // the graphics queue without a transfer family
+	GpuTimelineSupport timelineSupport = GpuTimelineSupport::None;
+
+	void create()
+	{
+		// the newest version the loader knows, timeline semaphores need 1.1 at least
+		uint32_t apiVersion = VK_API_VERSION_1_0;
+		auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+			vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+		if (enumerateInstanceVersion != nullptr) {
+			enumerateInstanceVersion(&apiVersion);
+		}
+		apiVersion = std::min(apiVersion, VK_API_VERSION_1_3);
+
+		VkApplicationInfo appInfo{};
+		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName = "VulkanTriangleTests";
+		appInfo.apiVersion = apiVersion;
+		VkInstanceCreateInfo instanceInfo{};
+		instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		instanceInfo.pApplicationInfo = &appInfo;
+		if (vkCreateInstance(&instanceInfo, nullptr, &instance) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create a Vulkan instance, is a Vulkan driver installed?");
+		}
+
+		uint32_t deviceCount = 0;
+		vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+		std::vector<VkPhysicalDevice> devices(deviceCount);
+		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+		for (VkPhysicalDevice candidate : devices) {
+			uint32_t familyCount = 0;
+			vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount, nullptr);
+			std::vector<VkQueueFamilyProperties> families(familyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount, families.data());
+			auto graphics = std::find_if(families.begin(), families.end(), [](const VkQueueFamilyProperties& family) {
+				return (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+				});
+			if (graphics == families.end()) {
+				continue;
+			}
+			physicalDevice = candidate;
+			graphicsFamily = static_cast<uint32_t>(graphics - families.begin());
+			// the same choice as HelloTriangleApplication::findQueueFamilies
+			for (uint32_t family = 0; family < familyCount; family++) {
+				bool transferOnly = (families[family].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+					!(families[family].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+				VkExtent3D granularity = families[family].minImageTransferGranularity;
+				if (transferOnly && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+					transferFamily = family;
+					break;
+				}
+			}
+			break;
+		}
+		if (physicalDevice == VK_NULL_HANDLE) {
+			throw std::runtime_error("failed to find a GPU with a graphics queue!");
+		}
+
+		float queuePriority = 1.0f;
+		std::vector<VkDeviceQueueCreateInfo> queueInfos;
+		for (uint32_t family : { graphicsFamily, transferFamily.value_or(graphicsFamily) }) {
+			if (!queueInfos.empty() && queueInfos.back().queueFamilyIndex == family) {
+				continue;
+			}
+			VkDeviceQueueCreateInfo queueInfo{};
+			queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueInfo.queueFamilyIndex = family;
+			queueInfo.queueCount = 1;
+			queueInfo.pQueuePriorities = &queuePriority;
+			queueInfos.push_back(queueInfo);
+		}
+		VkDeviceCreateInfo deviceInfo{};
+		deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
+		deviceInfo.pQueueCreateInfos = queueInfos.data();
+		// timeline semaphores if the device has them, the GPU timeline falls back to fences otherwise
+		std::vector<const char*> extensions;
+		timelineSupport = GpuTimeline::querySupport(instance, apiVersion, physicalDevice);
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+		if (timelineSupport != GpuTimelineSupport::None) {
+			deviceInfo.pNext = &timelineFeatures;
+		}
+		if (timelineSupport == GpuTimelineSupport::Extension) {
+			extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		}
+		deviceInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		deviceInfo.ppEnabledExtensionNames = extensions.data();
+		if (vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create logical device!");
+		}
+		vkGetDeviceQueue(device, graphicsFamily, 0, &graphicsQueue);
+		transferQueue = graphicsQueue;
+		if (transferFamily.has_value()) {
+			vkGetDeviceQueue(device, transferFamily.value(), 0, &transferQueue);
+		}
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		std::cout << "test device: " << properties.deviceName << (transferFamily.has_value() ? ", with" : ", without")
+			<< " a transfer only queue family\n";
+	}
+
+	void destroy()
+	{
+		if (device != VK_NULL_HANDLE) {
+			vkDestroyDevice(device, nullptr);
+			device = VK_NULL_HANDLE;
+		}
+		if (instance != VK_NULL_HANDLE) {
+			vkDestroyInstance(instance, nullptr);
+			instance = VK_NULL_HANDLE;
+		}
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include "MemoryAllocator.h"
+#include "StagingPool.h"
+#include "GpuTimeline.h"
+#include "UploadContext.h"
+#include "TestDevice.h"
+
+// a buffer of its own memory, the way HelloTriangleApplication::createBuffer makes them
+inline void createTestBuffer(VkDevice device, DeviceMemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& memory)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create buffer!");
+	}
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &requirements);
+	memory = allocator.allocate(requirements, properties, MemoryResourceKind::Linear, false);
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+// stages a pattern, copies it into a device local buffer on the upload queue, hands the buffer to the graphics queue and
+// copies it back into host memory there, throws if what comes back differs
+// the copies go through the transfer queue if transferFamily differs from graphicsFamily, through the graphics queue otherwise
+inline void testUploadQueue(const TestDevice& gpu, uint32_t transferFamily, VkQueue transferQueue)
+{
+	DeviceMemoryAllocator allocator;
+	allocator.init(gpu.physicalDevice, gpu.device);
+	StagingPool stagingPool;
+	stagingPool.init(gpu.physicalDevice, gpu.device, allocator);
+	GpuTimeline timeline;
+	timeline.init(gpu.device, gpu.timelineSupport);
+	UploadContext uploads;
+	uploads.init(gpu.device, transferFamily, transferQueue, gpu.graphicsFamily, gpu.graphicsQueue, stagingPool, timeline);
+
+	const uint32_t wordCount = 256 * 1024;
+	std::vector<uint32_t> pattern(wordCount);
+	for (uint32_t i = 0; i < wordCount; i++) {
+		pattern[i] = i * 2654435761u;
+	}
+	VkDeviceSize size = wordCount * sizeof(uint32_t);
+
+	VkBuffer deviceBuffer, readbackBuffer;
+	MemoryAllocation deviceMemory, readbackMemory;
+	createTestBuffer(gpu.device, allocator, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, deviceBuffer, deviceMemory);
+	createTestBuffer(gpu.device, allocator, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackMemory);
+	memset(readbackMemory.mappedData, 0, static_cast<size_t>(size));
+
+	// the same path as vertex and index buffers: staging pool -> upload queue -> ownership transfer
+	VkCommandBuffer transferCommands = uploads.record();
+	for (const StagingSpan& span : stagingPool.stage(pattern.data(), size)) {
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = span.offset;
+		copyRegion.dstOffset = span.sourceOffset;
+		copyRegion.size = span.size;
+		vkCmdCopyBuffer(transferCommands, span.buffer, deviceBuffer, 1, &copyRegion);
+	}
+	uploads.transferToGraphics(deviceBuffer, 0, size, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	VkCommandBuffer graphicsCommands = uploads.recordGraphics();
+	VkBufferCopy copyRegion{};
+	copyRegion.size = size;
+	vkCmdCopyBuffer(graphicsCommands, deviceBuffer, readbackBuffer, 1, &copyRegion);
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = readbackBuffer;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(graphicsCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	uploads.wait(uploads.submit());
+
+	bool matches = memcmp(readbackMemory.mappedData, pattern.data(), static_cast<size_t>(size)) == 0;
+	bool usedTransferQueue = uploads.usesTransferQueue();
+	vkDestroyBuffer(gpu.device, deviceBuffer, nullptr);
+	allocator.free(deviceMemory);
+	vkDestroyBuffer(gpu.device, readbackBuffer, nullptr);
+	allocator.free(readbackMemory);
+	uploads.destroy();
+	stagingPool.destroy();
+	timeline.destroy();
+	allocator.destroy();
+	if (!matches) {
+		throw std::runtime_error("upload queue test failed, the graphics queue read back something else than was uploaded!");
+	}
+	std::cout << "upload queue test: " << size / 1024 << " KiB uploaded on "
+		<< (usedTransferQueue ? "the transfer queue and handed to the graphics queue family"
+			: "the graphics queue (fallback, no transfer only queue family in use)") << "\n";
+}
+
+// the graphics queue fallback on every device, the transfer queue path too where there is a transfer only family
+inline void testUploadQueues()
+{
+	TestDevice gpu;
+	gpu.create();
+	testUploadQueue(gpu, gpu.graphicsFamily, gpu.graphicsQueue);
+	if (gpu.transferFamily.has_value()) {
+		testUploadQueue(gpu, gpu.transferFamily.value(), gpu.transferQueue);
+	}
+	gpu.destroy();
+}
@@ -0,0 +1,44 @@
+// tests for the engine's subsystems, they include the headers of VulkanTriangle directly and do not open a window
+//   VulkanTriangleTests.exe            every test
+//   VulkanTriangleTests.exe allocator  only the tests named on the command line
+// the exit code is the number of tests which failed, the GPU tests run on the first device with a graphics queue
+// (lavapipe works, so they can run without a GPU)
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include "AllocatorTests.h"
+#include "UploadQueueTests.h"
+
+struct Test {
+	const char* name;
+	void (*run)();
+};
+
+const Test tests[] = {
+	{ "allocator", stressTestAllocator },
+	{ "upload_queues", testUploadQueues },
+};
+
+int main(int argc, char** argv)
+{
+	int failed = 0;
+	for (const Test& test : tests) {
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++) {
+			selected = selected || strcmp(argv[i], test.name) == 0;
+		}
+		if (!selected) {
+			continue;
+		}
+
+		try {
+			test.run();
+			std::cout << test.name << ": passed\n";
+		}
+		catch (const std::exception& e) {
+			std::cerr << test.name << ": " << e.what() << std::endl;
+			failed++;
+		}
+	}
+	return failed;
+}